@@ -41,7 +41,7 @@ public:
     static std::size_t Register(Constructor constructor, Destructor destructor)
     {
         std::unique_lock<std::mutex> lock(GetMutex());
-        std::unique_lock<LFLock> inited(GetInitGuard(), std::defer_lock);
+        std::unique_lock<LFFlag> inited(GetInitGuard(), std::defer_lock);
         if (!inited.try_lock())
             throw std::logic_error("Anys::Register mustbe at front of new first instance.");
 
@@ -96,9 +96,9 @@ private:
         static std::size_t obj = 0;
         return obj;
     }
-    inline static LFLock & GetInitGuard()
+    inline static LFFlag & GetInitGuard()
     {
-        static LFLock obj;
+        static LFFlag obj;
         return obj;
     }
 
@@ -33,7 +33,7 @@ public:
     }
 
     static void ThreadRun() {
-        std::unique_lock<LFLock> lock(self().threadInit_, std::defer_lock);
+        std::unique_lock<LFFlag> lock(self().threadInit_, std::defer_lock);
         if (!lock.try_lock()) return;
 
         for (;;std::this_thread::sleep_for(std::chrono::milliseconds(20))) {
@@ -63,7 +63,7 @@ private:
             uint64_t tsc_ = 0;
         };
 
-        LFLock threadInit_;
+        LFFlag threadInit_;
         bool fast_ = false;
         double cycle_ = 1;
         CheckPoint checkPoint_[2];
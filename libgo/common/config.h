@@ -119,6 +119,14 @@ enum class eCoExHandle : uint8_t
     on_listener,        // ʹlistener, ûlistener׳
 };
 
+// Э̷ŵĸ߳
+enum class eTaskPlacement : uint8_t
+{
+    local_first,    // ǰ߳(Эдʱ), ĵ߳̿ʼ
+    power_of_two,   // ȡ̱߳Ƚϸ, ŵһ; Эдʱһǵǰ߳
+    round_robin,    // 
+};
+
 typedef void*(*stack_malloc_fn_t)(size_t size);
 typedef void(*stack_free_fn_t)(void *ptr);
 
@@ -159,6 +167,41 @@ struct CoroutineOptions
     //  ִеЭȽʱ,ֵһ,ЭȽʱ,һ
     float load_balance_rate = 0.01; 
 
+    // ΪBlockingRegionԤȴıõ߳(maxThreadNumber, maxThreadNumber-minThreadNumber)
+    // BlockingRegionʱ, Элõĵ߳, صȴcycle_timeout_ussteal
+    uint32_t blocking_spare_threads = 1;
+
+    // minThreadNumberͱ߳ĵ߳̿жú˳(λ΢), 0ʾ˳
+    // ˳ǰʣЭ̽߳, ֮Ҫչ߳ʱProcesser
+    uint32_t idle_thread_exit_us = 10 * 1000 * 1000;
+
+    // Էsocketfd(ͨļ)read/writeȵǷԶBlockingRegion(Ĭϲ)
+    bool hook_blocking_region = false;
+
+    // 첽ռʱƬ(λ΢), 0ʾ(Ĭϲ, LinuxЧ)
+    // ߳Эִгʱĵ̷߳SIGURGź, ڰȫЭгŵβ:
+    // Эռ(NonPreemptible), ûгlibgoڲ, ִ(libcȶ̬)Ĵ.
+    // õñcycle_timeout_usС, ж֮ǰռ.
+    uint32_t preempt_time_slice_us = 0;
+
+    // co_maybe_yieldÿöٴμһʱƬ
+    int maybe_yield_budget = 1024;
+
+    // co_maybe_yieldʱƬ(λ΢), Э̱εִгʱг. 0ʾÿһδԤг
+    uint32_t maybe_yield_slice_us = 1000;
+
+    // ֮ʱȵֵ(λ΢), TaskGroup
+    // ԽС֮ķݶԽȷ, ƳŻЭԽƵ
+    uint32_t task_group_granularity_us = 2000;
+
+    // Элͬһ߳ϵЭʱ, Ƿrun-nextλýǰЭִ֮, Processer::Wakeup
+    bool wakeup_run_next = true;
+
+    // Э̵ķò
+    // power_of_twoȡ̵߳ؼ, һЭЭʱᶼͬһ߳ϵȵ߳.
+    // Ĭϵlocal_firstԭΪ: ԭ߳Ⱥ󴴽Эͬһ߳ϰ˳ִ.
+    eTaskPlacement task_placement = eTaskPlacement::local_first;
+
     // ջñڴεڴҳ(linuxЧ)(ĬΪ0, :)
     // ջڴǰҳΪprotect.
     // Կѡʱ, stack_sizeprotect_stack_page+1ҳ
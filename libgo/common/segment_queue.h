@@ -0,0 +1,290 @@
+#pragma once
+#include "config.h"
+#include "spinlock.h"
+
+namespace co
+{
+
+// 无锁的分段队列(MPMC, 无界)
+// 1.由固定大小的Segment串成单链表, Segment内的读写下标都用fetch_add分配(FAA array queue),
+//   只有Segment写满时才需要CAS链接新的Segment, 不会为每个元素分配内存.
+// 2.读者抢到的下标上如果写者还未写入, 就把它标记为taken, 写者发现后换一个下标重试.
+// 3.Segment的生命周期用分离引用计数(split reference count)管理:
+//   head_/tail_的高16位是外部计数, 访问Segment前先fetch_add外部计数拿到引用, 用完后减少内部计数;
+//   head_/tail_移到下一个Segment时, 再把外部计数转移到内部计数中. 内部计数归零时回收.
+// 4.回收的Segment放入一个有上限的缓存池复用, 超出上限的直接释放, 内存按Segment为单位伸缩.
+template <typename T, std::size_t SegmentSize = 512>
+class SegmentQueue
+{
+    enum eSlotState : uint32_t
+    {
+        slot_empty = 0,
+        slot_ready = 1,
+        slot_taken = 2,
+    };
+
+    struct Slot
+    {
+        atomic_t<uint32_t> state;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* get() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    struct Segment
+    {
+        atomic_t<std::size_t> enq;
+        char pad0_[64];
+        atomic_t<std::size_t> deq;
+        char pad1_[64];
+        atomic_t<Segment*> next;
+        atomic_t<int64_t> refs;     // 内部计数
+        Slot slots[SegmentSize];
+    };
+
+    static const int kCountShift = 48;
+    static const uint64_t kPtrMask = ((uint64_t)1 << kCountShift) - 1;
+    static const uint64_t kCountOne = (uint64_t)1 << kCountShift;
+
+    // 外部计数超过此值时合并到内部计数, 防止16位溢出
+    static const uint64_t kFoldCount = 1 << 14;
+
+    // head_和tail_各持有一份, 两个都移走后才可能回收
+    static const int64_t kHolder = (int64_t)1 << 32;
+
+    atomic_t<uint64_t> head_;
+    char pad0_[64];
+    atomic_t<uint64_t> tail_;
+    char pad1_[64];
+
+    // 回收池
+    LFLock poolLock_;
+    Segment* pool_ = nullptr;
+    std::size_t poolSize_ = 0;
+    const std::size_t poolCapacity_;
+
+public:
+    // @poolCapacity: 最多缓存多少个空闲的Segment
+    explicit SegmentQueue(std::size_t poolCapacity = 4)
+        : poolCapacity_(poolCapacity)
+    {
+        Segment* seg = allocSegment();
+        head_ = pack(seg);
+        tail_ = pack(seg);
+    }
+
+    ~SegmentQueue()
+    {
+        // 已没有并发访问, tail_最多落后head_一个Segment
+        Segment* tail = unpack(tail_);
+        Segment* seg = unpack(head_);
+        bool tailInList = false;
+        while (seg) {
+            if (seg == tail) tailInList = true;
+            Segment* next = seg->next;
+            destroySegment(seg);
+            seg = next;
+        }
+        if (!tailInList)
+            destroySegment(tail);
+
+        while (pool_) {
+            Segment* next = pool_->next;
+            delete pool_;
+            pool_ = next;
+        }
+    }
+
+    SegmentQueue(SegmentQueue const&) = delete;
+    SegmentQueue& operator=(SegmentQueue const&) = delete;
+
+    // 写入成功后t中的数据被move走
+    void Push(T && t)
+    {
+        for (;;) {
+            Segment* ltail = acquire(tail_);
+            std::size_t idx = ltail->enq.fetch_add(1, std::memory_order_acq_rel);
+            if (idx < SegmentSize) {
+                Slot & slot = ltail->slots[idx];
+                new (slot.get()) T(std::move(t));
+                uint32_t expected = slot_empty;
+                if (slot.state.compare_exchange_strong(expected, slot_ready,
+                            std::memory_order_release, std::memory_order_relaxed))
+                {
+                    release(ltail);
+                    return ;
+                }
+
+                // 被读者标记为taken, 取回数据换一个位置重试
+                t = std::move(*slot.get());
+                slot.get()->~T();
+                release(ltail);
+                continue;
+            }
+
+            // 当前Segment已写满, 链接一个新的
+            Segment* lnext = ltail->next.load(std::memory_order_acquire);
+            if (!lnext) {
+                Segment* seg = allocSegment();
+                new (seg->slots[0].get()) T(std::move(t));
+                seg->slots[0].state.store(slot_ready, std::memory_order_relaxed);
+                seg->enq.store(1, std::memory_order_relaxed);
+                if (ltail->next.compare_exchange_strong(lnext, seg,
+                            std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    advance(tail_, ltail, seg);
+                    release(ltail);
+                    return ;
+                }
+
+                // 别人先链接上了
+                t = std::move(*seg->slots[0].get());
+                seg->slots[0].get()->~T();
+                freeSegment(seg);
+            }
+
+            advance(tail_, ltail, lnext);
+            release(ltail);
+        }
+    }
+
+    // 队列为空时返回false
+    bool Pop(T & t)
+    {
+        for (;;) {
+            Segment* lhead = acquire(head_);
+            if (lhead->deq.load(std::memory_order_acquire) >= lhead->enq.load(std::memory_order_acquire)
+                    && !lhead->next.load(std::memory_order_acquire))
+            {
+                release(lhead);
+                return false;
+            }
+
+            std::size_t idx = lhead->deq.fetch_add(1, std::memory_order_acq_rel);
+            if (idx < SegmentSize) {
+                Slot & slot = lhead->slots[idx];
+                if (slot.state.exchange(slot_taken, std::memory_order_acq_rel) == slot_ready) {
+                    t = std::move(*slot.get());
+                    slot.get()->~T();
+                    release(lhead);
+                    return true;
+                }
+
+                // 写者还没写完, 让它换位置重试
+                release(lhead);
+                continue;
+            }
+
+            // 当前Segment已读完
+            Segment* lnext = lhead->next.load(std::memory_order_acquire);
+            if (!lnext) {
+                release(lhead);
+                return false;
+            }
+
+            advance(head_, lhead, lnext);
+            release(lhead);
+        }
+    }
+
+private:
+    static uint64_t pack(Segment* seg)
+    {
+        assert(((uint64_t)(uintptr_t)seg & ~kPtrMask) == 0);
+        return (uint64_t)(uintptr_t)seg;
+    }
+
+    static Segment* unpack(uint64_t v)
+    {
+        return (Segment*)(uintptr_t)(v & kPtrMask);
+    }
+
+    // 增加外部计数, 拿到ref当前指向的Segment的引用
+    Segment* acquire(atomic_t<uint64_t> & ref)
+    {
+        uint64_t v = ref.fetch_add(kCountOne, std::memory_order_acquire) + kCountOne;
+        Segment* seg = unpack(v);
+        uint64_t count = v >> kCountShift;
+        if (count >= kFoldCount &&
+                ref.compare_exchange_strong(v, pack(seg),
+                    std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            seg->refs.fetch_add((int64_t)count, std::memory_order_relaxed);
+        }
+        return seg;
+    }
+
+    void release(Segment* seg)
+    {
+        if (seg->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            freeSegment(seg);
+    }
+
+    // 把ref从from移到to, 成功的一方负责转移外部计数并放弃from的持有
+    void advance(atomic_t<uint64_t> & ref, Segment* from, Segment* to)
+    {
+        uint64_t v = ref.load(std::memory_order_acquire);
+        while (unpack(v) == from) {
+            if (ref.compare_exchange_weak(v, pack(to),
+                        std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                int64_t delta = (int64_t)(v >> kCountShift) - kHolder;
+                if (from->refs.fetch_add(delta, std::memory_order_acq_rel) + delta == 0)
+                    freeSegment(from);
+                return ;
+            }
+        }
+    }
+
+    Segment* allocSegment()
+    {
+        Segment* seg = nullptr;
+        {
+            std::unique_lock<LFLock> lock(poolLock_);
+            if (pool_) {
+                seg = pool_;
+                pool_ = seg->next;
+                --poolSize_;
+            }
+        }
+
+        if (!seg)
+            seg = new Segment;
+
+        seg->enq.store(0, std::memory_order_relaxed);
+        seg->deq.store(0, std::memory_order_relaxed);
+        seg->next.store(nullptr, std::memory_order_relaxed);
+        seg->refs.store(2 * kHolder, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < SegmentSize; ++i)
+            seg->slots[i].state.store(slot_empty, std::memory_order_relaxed);
+        return seg;
+    }
+
+    // 所有元素都已被读走或取回
+    void freeSegment(Segment* seg)
+    {
+        {
+            std::unique_lock<LFLock> lock(poolLock_);
+            if (poolSize_ < poolCapacity_) {
+                seg->next.store(pool_, std::memory_order_relaxed);
+                pool_ = seg;
+                ++poolSize_;
+                return ;
+            }
+        }
+
+        delete seg;
+    }
+
+    // 析构时调用, 销毁还未读走的元素
+    void destroySegment(Segment* seg)
+    {
+        std::size_t end = (std::min)(seg->enq.load(), SegmentSize);
+        for (std::size_t i = 0; i < end; ++i)
+            if (seg->slots[i].state == slot_ready)
+                seg->slots[i].get()->~T();
+        delete seg;
+    }
+};
+
+} //namespace co
@@ -5,6 +5,27 @@
 namespace co
 {
 
+// 自旋等待时调用, 降低功耗并把流水线让给同一核心上的超线程
+ALWAYS_INLINE void CpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// 本线程上禁止异步抢占的层数(见CoroutineOptions::preempt_time_slice_us)
+// 协程被抢占时, 同一线程上的其他协程接着执行. 持有libgo内部锁、处于批量唤醒作用域或RCU读临界区时
+// 不能切换协程(否则可能死锁或提前结束宽限期), 在这些地方加1, 离开时减1.
+ALWAYS_INLINE int & PreemptOffDepth()
+{
+    static thread_local int depth = 0;
+    return depth;
+}
+
 struct BooleanFakeLock
 {
     bool locked_ = false;
@@ -45,19 +66,85 @@ struct LFLock
     {
     }
 
+    // 先禁止抢占再加锁, 先解锁再允许抢占: 中间被抢占就成了持有锁的协程被切走
     ALWAYS_INLINE void lock()
     {
+        ++ PreemptOffDepth();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
         while (flag.test_and_set(std::memory_order_acquire)) ;
     }
 
     ALWAYS_INLINE bool try_lock()
     {
-        return !flag.test_and_set(std::memory_order_acquire);
+        ++ PreemptOffDepth();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (flag.test_and_set(std::memory_order_acquire)) {
+            -- PreemptOffDepth();
+            return false;
+        }
+        return true;
     }
     
     ALWAYS_INLINE void unlock()
     {
         flag.clear(std::memory_order_release);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        -- PreemptOffDepth();
+    }
+};
+
+// 与LFLock接口相同的标记(已启动、已被认领、正在等待等), 置位后往往不在同一线程上清除,
+// 或者在持有期间切换协程, 不是临界区, 所以不计入PreemptOffDepth
+struct LFFlag
+{
+    std::atomic_flag flag;
+
+    LFFlag() : flag{false}
+    {
+    }
+
+    ALWAYS_INLINE void lock()
+    {
+        while (flag.test_and_set(std::memory_order_acquire)) ;
+    }
+
+    ALWAYS_INLINE bool try_lock()
+    {
+        return !flag.test_and_set(std::memory_order_acquire);
+    }
+
+    ALWAYS_INLINE void unlock()
+    {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+// 持有期间禁止异步抢占的std::mutex, 用于协程中短暂持有的内部锁
+struct RuntimeMutex : public std::mutex
+{
+    void lock()
+    {
+        ++ PreemptOffDepth();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        std::mutex::lock();
+    }
+
+    bool try_lock()
+    {
+        ++ PreemptOffDepth();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (!std::mutex::try_lock()) {
+            -- PreemptOffDepth();
+            return false;
+        }
+        return true;
+    }
+
+    void unlock()
+    {
+        std::mutex::unlock();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        -- PreemptOffDepth();
     }
 };
 
@@ -10,6 +10,7 @@ enum {
     opt_stack_size,
     opt_dispatch,
     opt_affinity,
+    opt_group,
 };
 
 template <int OptType>
@@ -37,6 +38,13 @@ struct __go_option<opt_affinity>
     explicit __go_option(bool affinity) : affinity_(affinity) {}
 };
 
+template <>
+struct __go_option<opt_group>
+{
+    TaskGroup* group_;
+    explicit __go_option(TaskGroup* group) : group_(group) {}
+};
+
 struct __go
 {
     __go(const char* file, int lineno)
@@ -82,6 +90,12 @@ struct __go
         return *this;
     }
 
+    ALWAYS_INLINE __go& operator-(__go_option<opt_group> const& opt)
+    {
+        opt_.group_ = opt.group_;
+        return *this;
+    }
+
     TaskOpt opt_;
     Scheduler* scheduler_;
 };
@@ -7,10 +7,21 @@
 #include "util.h"
 #include "dbg_timer.h"
 #include <condition_variable>
+#include <functional>
 
 namespace co
 {
 
+// 一次触发多个定时器时的作用域对象, 默认什么都不做
+template <typename F>
+struct TimerTriggerScope
+{
+};
+
+// 调度器的定时器把同一次触发的唤醒合并为批量唤醒(定义在scheduler/processer.h)
+template <>
+struct TimerTriggerScope<std::function<void()>>;
+
 template <typename F>
 class Timer : public IdCounter<Timer<F>>
 {
@@ -18,7 +29,7 @@ public:
     struct Element : public TSQueueHook, public RefObject, public IdCounter<Element>
     {
         F cb_;
-        LFLock active_;
+        LFFlag active_;
         FastSteadyClock::time_point tp_;
         void* volatile slot_;
 
@@ -31,7 +42,7 @@ public:
         }
 
         inline void call() noexcept {
-            std::unique_lock<LFLock> lock(active_, std::defer_lock);
+            std::unique_lock<LFFlag> lock(active_, std::defer_lock);
             if (!lock.try_lock()) return ;
             slot_ = nullptr;
             cb_();
@@ -395,6 +406,8 @@ template <typename F>
 void Timer<F>::Trigger(Slot & slot)
 {
     SList<Element> slist = slot.pop_all();
+    TimerTriggerScope<F> scope;
+    (void)scope;
     for (Element & element : slist) {
         slist.erase(&element);
         DebugPrint(dbg_timer, "[id=%ld]Timer trigger element=%ld precision= %d us",
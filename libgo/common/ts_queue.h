@@ -269,6 +269,11 @@ public:
         return !count_;
     }
 
+    ALWAYS_INLINE std::size_t sizeUnsafe()
+    {
+        return count_;
+    }
+
     ALWAYS_INLINE std::size_t size()
     {
         LockGuard lock(*lock_);
@@ -431,6 +436,27 @@ public:
         return count_;
     }
 
+    // 插入到pos之后, pos必须在本队列中
+    ALWAYS_INLINE size_t insertAfterWithoutLock(T* pos, T* element, bool refCount = true)
+    {
+        TSQueueHook *hook = static_cast<TSQueueHook*>(element);
+        TSQueueHook *posHook = static_cast<TSQueueHook*>(pos);
+        assert(posHook->check_ == check_);
+        assert(hook->next == nullptr);
+        assert(hook->prev == nullptr);
+        TSQueueHook *next = posHook->next;
+        hook->prev = posHook;
+        hook->next = next;
+        posHook->next = hook;
+        if (next) next->prev = hook;
+        else tail_ = hook;
+        hook->check_ = check_;
+        ++ count_;
+        if (refCount)
+            IncrementRef(element);
+        return count_;
+    }
+
     ALWAYS_INLINE size_t push(T* element)
     {
         LockGuard lock(*lock_);
@@ -17,7 +17,8 @@ public:
         DebugPrint(dbg_task, "valloc stack. size=%u ptr=%p",
                 stackSize_, stack_);
 
-        ctx_ = make_fcontext(stack_ + stackSize_, stackSize_, fn_);
+        // 栈上的上下文推迟到第一次切入时再初始化: 栈内存(包括最热的栈顶)由第一个执行协程的调度线程
+        // 首次写入, 按操作系统的first-touch策略分配在该线程所在的NUMA节点上.
 
         int protectPage = StackTraits::GetProtectStackPageSize();
         if (protectPage && StackTraits::ProtectStack(stack_, stackSize_, protectPage))
@@ -36,6 +37,8 @@ public:
 
     ALWAYS_INLINE void SwapIn()
     {
+        if (UNLIKELY(!ctx_))
+            ctx_ = make_fcontext(stack_ + stackSize_, stackSize_, fn_);
         jump_fcontext(&GetTlsContext(), ctx_, vp_);
     }
 
@@ -56,7 +59,7 @@ public:
     }
 
 private:
-    fcontext_t ctx_;
+    fcontext_t ctx_ = nullptr;
     fn_t fn_;
     intptr_t vp_;
     char* stack_ = nullptr;
@@ -4,10 +4,20 @@
 #include "common/pp.h"
 #include "common/syntax_helper.h"
 #include "sync/channel.h"
+#include "sync/broadcast_channel.h"
 #include "sync/co_mutex.h"
 #include "sync/co_rwmutex.h"
+#include "sync/co_condition.h"
+#include "sync/rcu.h"
+#include "sync/seq_lock.h"
+#include "sync/wait_group.h"
+#include "sync/barrier.h"
+#include "sync/semaphore.h"
 #include "timer/timer.h"
 #include "scheduler/processer.h"
+#include "scheduler/blocking_region.h"
+#include "scheduler/non_preemptible.h"
+#include "scheduler/task_group.h"
 #include "cls/co_local_storage.h"
 #include "pool/connection_pool.h"
 #include "pool/async_coroutine_pool.h"
@@ -24,11 +34,15 @@
 // create coroutine options
 #define co_stack(size) ::co::__go_option<::co::opt_stack_size>{size}-
 #define co_scheduler(pScheduler) ::co::__go_option<::co::opt_scheduler>{pScheduler}-
+#define co_group(pGroup) ::co::__go_option<::co::opt_group>{pGroup}-
 
 #define go_stack(size) go co_stack(size)
 
 #define co_yield do { ::co::Processer::StaticCoYield(); } while (0)
 
+// 有预算的让出, 时间片用完才切出, 可以在长循环中每次迭代都调用
+#define co_maybe_yield() do { ::co::Processer::MaybeYield(); } while (0)
+
 // coroutine sleep, never blocks current thread if run in coroutine.
 #if defined(LIBGO_SYS_Unix)
 # define co_sleep(milliseconds) do { usleep(1000 * milliseconds); } while (0)
@@ -49,6 +63,30 @@ using ::co::co_rwmutex;
 using ::co::co_rmutex;
 using ::co::co_wmutex;
 
+// co_condition_variable
+using ::co::co_condition_variable;
+
+// co_wait_group, co_latch, co_barrier, co_semaphore
+using ::co::co_wait_group;
+using ::co::co_latch;
+using ::co::co_barrier;
+using ::co::co_semaphore;
+
+// co_seqlock
+using ::co::co_seqlock;
+
+// co_rcu_read_lock
+using ::co::co_rcu_read_lock;
+
+// co_blocking_region
+using ::co::co_blocking_region;
+
+// co_non_preemptible
+using ::co::co_non_preemptible;
+
+// co_task_group
+using ::co::co_task_group;
+
 // co_chan
 using ::co::co_chan;
 
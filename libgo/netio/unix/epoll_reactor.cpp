@@ -87,6 +87,9 @@ void EpollReactor::Run()
     const int cEvent = 1024;
     struct epoll_event evs[cEvent];
     int n = CallWithoutINTR<int>(::epoll_wait, epfd_, evs, cEvent, 10);
+
+    // 同一批就绪事件唤醒的协程合并为一次批量唤醒
+    WakeupBatch batch;
     for (int i = 0; i < n; ++i) {
         struct epoll_event & ev = evs[i];
         int fd = ev.data.fd;
@@ -13,6 +13,7 @@
 #include <stdarg.h>
 #include <poll.h>
 #include "../../scheduler/processer.h"
+#include "../../scheduler/blocking_region.h"
 #include "reactor.h"
 #include "hook_helper.h"
 #include "../../sync/co_mutex.h"
@@ -175,6 +176,15 @@ static ssize_t read_write_mode(int fd, OriginF fn, const char* hook_fn_name,
 
     FdContextPtr ctx = HookHelper::getInstance().GetFdContext(fd);
 
+    if (!ctx && CoroutineOptions::getInstance().hook_blocking_region) {
+        // 普通文件和块设备的读写不能用poll等待, 在BlockingRegion中执行
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+            BlockingRegion region;
+            return fn(fd, std::forward<Args>(args)...);
+        }
+    }
+
     if (!ctx || ctx->IsNonBlocking())
         return fn(fd, std::forward<Args>(args)...);
 
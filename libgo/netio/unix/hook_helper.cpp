@@ -56,7 +56,7 @@ void HookHelper::OnDup(int from, int to)
 HookHelper::FdSlotPtr HookHelper::GetSlot(int fd)
 {
     int bucketIdx = fd & kBucketCount;
-    std::unique_lock<std::mutex> lock(bucketMtx_[bucketIdx]);
+    std::unique_lock<RuntimeMutex> lock(bucketMtx_[bucketIdx]);
     auto & bucket = buckets_[bucketIdx];
     auto itr = bucket.find(fd);
     if (itr == bucket.end())
@@ -77,7 +77,7 @@ FdContextPtr HookHelper::GetFdContext(int fd)
 void HookHelper::Insert(int fd, FdContextPtr ctx)
 {
     int bucketIdx = fd & kBucketCount;
-    std::unique_lock<std::mutex> lock(bucketMtx_[bucketIdx]);
+    std::unique_lock<RuntimeMutex> lock(bucketMtx_[bucketIdx]);
     auto & bucket = buckets_[bucketIdx];
     FdSlotPtr & slot = bucket[fd];
     if (!slot) slot.reset(new FdSlot);
@@ -50,7 +50,7 @@ private:
 private:
     typedef std::unordered_map<int, FdSlotPtr> Slots;
     Slots buckets_[kBucketCount+1];
-    std::mutex bucketMtx_[kBucketCount+1];
+    RuntimeMutex bucketMtx_[kBucketCount+1];
 };
 
 } // namespace co
@@ -80,6 +80,9 @@ void KqueueReactor::Run()
     timeout.tv_nsec = 10 * 1000 * 1000;
     int n = kevent(kq_, nullptr, 0, kev, cEvent, &timeout);
     std::unordered_map<int, short int> eventMap;
+
+    // 同一批就绪事件唤醒的协程合并为一次批量唤醒
+    WakeupBatch batch;
     for (int i = 0; i < n; ++i) {
         struct kevent & ev = kev[i];
 
@@ -17,7 +17,7 @@ void ReactorElement::OnClose()
 
 bool ReactorElement::Add(Reactor * reactor, short int pollEvent, Entry const& entry)
 {
-    std::unique_lock<std::mutex> lock(mtx_);
+    std::unique_lock<RuntimeMutex> lock(mtx_);
     EntryList & entryList = SelectList(pollEvent);
     CheckExpire(entryList);
     entryList.push_back(entry);
@@ -53,7 +53,7 @@ void ReactorElement::Rollback(EntryList & entryList, Entry const& entry)
 
 void ReactorElement::Trigger(Reactor * reactor, short int pollEvent)
 {
-    std::unique_lock<std::mutex> lock(mtx_);
+    std::unique_lock<RuntimeMutex> lock(mtx_);
 
     short int errEvent = POLLERR | POLLHUP | POLLNVAL;
     short int promiseEvent = 0;
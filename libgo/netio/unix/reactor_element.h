@@ -46,7 +46,7 @@ protected:
     void CheckExpire(EntryList & entryList);
 
 private:
-    std::mutex mtx_;
+    RuntimeMutex mtx_;
 
     int fd_;
     short int event_ = 0;
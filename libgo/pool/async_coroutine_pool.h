@@ -83,7 +83,7 @@ private:
     size_t maxCallbackPoints_;
     std::atomic<size_t> robin_{0};
     CallbackPoint ** points_;
-    LFLock started_;
+    LFFlag started_;
 };
 
 } // namespace co
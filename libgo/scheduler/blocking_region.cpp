@@ -0,0 +1,25 @@
+#include "blocking_region.h"
+#include "processer.h"
+
+namespace co
+{
+
+BlockingRegion::BlockingRegion()
+    : proc_(nullptr)
+{
+    Processer* proc = Processer::GetCurrentProcesser();
+    if (!proc || !Processer::IsCoroutine() || proc->blocking_)
+        return ;
+
+    if (proc->EnterBlocking())
+        proc_ = proc;
+}
+
+BlockingRegion::~BlockingRegion()
+{
+    // 区域内挂起过时, 可能已经在别的调度线程上
+    if (proc_)
+        proc_->LeaveBlocking(Processer::GetCurrentTask());
+}
+
+} //namespace co
@@ -0,0 +1,37 @@
+#pragma once
+#include "../common/config.h"
+
+namespace co
+{
+
+class Processer;
+
+/// 阻塞区域
+// 协程中要执行不经过hook的阻塞调用(CPU密集的库函数, 文件IO, 第三方同步客户端等)时, 用它包住阻塞调用:
+//   {
+//       co::BlockingRegion region;
+//       heavy_call();
+//   }
+// 进入时当前调度线程上的其余协程立即交给空闲或备用的调度线程, 期间被唤醒的协程也直接交给它,
+// 不必等调度线程在cycle_timeout_us后判定阻塞再steal. 退出后当前调度线程作为备用线程, 按需重新激活.
+// 区域内挂起(等待channel、sleep等)时区域随即结束, 恢复执行后不再受保护, 可能在别的调度线程上.
+// 没有其他调度线程可以接手时什么也不做. 不在协程中或者嵌套使用时也什么都不做.
+// 备用线程数见CoroutineOptions::blocking_spare_threads.
+class BlockingRegion
+{
+    Processer* proc_;
+
+public:
+    BlockingRegion();
+    ~BlockingRegion();
+
+    BlockingRegion(BlockingRegion const&) = delete;
+    BlockingRegion& operator=(BlockingRegion const&) = delete;
+
+    // 是否已把其余协程交给其他调度线程
+    bool IsHandedOff() const { return !!proc_; }
+};
+
+typedef BlockingRegion co_blocking_region;
+
+} //namespace co
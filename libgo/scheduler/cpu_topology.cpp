@@ -0,0 +1,152 @@
+#include "cpu_topology.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#if defined(LIBGO_SYS_Linux)
+#include <sched.h>
+#endif
+
+namespace co
+{
+
+CpuTopology& CpuTopology::getInstance()
+{
+    static CpuTopology obj;
+    return obj;
+}
+
+CpuTopology::CpuTopology()
+{
+    Load();
+}
+
+CpuTopology::Distance CpuTopology::GetDistance(int cpu1, int cpu2) const
+{
+    if (cpu1 < 0 || cpu2 < 0 || cpu1 >= (int)cpus_.size() || cpu2 >= (int)cpus_.size())
+        return remote;
+
+    if (cpu1 == cpu2)
+        return same_core;
+
+    CpuInfo const& a = cpus_[cpu1];
+    CpuInfo const& b = cpus_[cpu2];
+    if (a.core >= 0 && a.core == b.core)
+        return same_core;
+    if (a.llc >= 0 && a.llc == b.llc)
+        return same_llc;
+    if (a.node >= 0 && a.node == b.node)
+        return same_node;
+    return remote;
+}
+
+int CpuTopology::NodeOf(int cpu) const
+{
+    if (cpu < 0 || cpu >= (int)cpus_.size())
+        return -1;
+    return cpus_[cpu].node;
+}
+
+int CpuTopology::CurrentCpu()
+{
+#if defined(LIBGO_SYS_Linux)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+void CpuTopology::Load()
+{
+#if defined(LIBGO_SYS_Linux)
+    std::string s;
+    if (!ReadFile("/sys/devices/system/cpu/online", s))
+        return ;
+
+    std::vector<int> online = ParseCpuList(s);
+    if (online.empty())
+        return ;
+
+    std::vector<CpuInfo> cpus(*std::max_element(online.begin(), online.end()) + 1);
+    for (int cpu : online) {
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        CpuInfo & info = cpus[cpu];
+
+        info.core = cpu;
+        if (ReadFile(base + "/topology/thread_siblings_list", s) ||
+                ReadFile(base + "/topology/core_cpus_list", s)) {
+            std::vector<int> siblings = ParseCpuList(s);
+            if (!siblings.empty())
+                info.core = *std::min_element(siblings.begin(), siblings.end());
+        }
+
+        // 末级缓存: 级别最高的数据缓存
+        int llcLevel = 0;
+        for (int idx = 0; ; ++idx) {
+            std::string cache = base + "/cache/index" + std::to_string(idx);
+            if (!ReadFile(cache + "/level", s))
+                break;
+
+            int level = atoi(s.c_str());
+            std::string type;
+            if (ReadFile(cache + "/type", type) && type.compare(0, 11, "Instruction") == 0)
+                continue;
+            if (level < llcLevel || !ReadFile(cache + "/shared_cpu_list", s))
+                continue;
+
+            std::vector<int> shared = ParseCpuList(s);
+            if (shared.empty())
+                continue;
+
+            llcLevel = level;
+            info.llc = *std::min_element(shared.begin(), shared.end());
+        }
+    }
+
+    if (ReadFile("/sys/devices/system/node/online", s)) {
+        for (int node : ParseCpuList(s)) {
+            std::string nodeCpus;
+            if (!ReadFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", nodeCpus))
+                continue;
+
+            for (int cpu : ParseCpuList(nodeCpus))
+                if (cpu < (int)cpus.size())
+                    cpus[cpu].node = node;
+        }
+    }
+
+    cpus_.swap(cpus);
+    DebugPrint(dbg_scheduler, "Load cpu topology: %d cpus", (int)cpus_.size());
+#endif
+}
+
+std::vector<int> CpuTopology::ParseCpuList(std::string const& s)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(s);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range[0] < '0' || range[0] > '9')
+            continue;
+
+        int first = atoi(range.c_str());
+        int last = first;
+        std::size_t dash = range.find('-');
+        if (dash != std::string::npos)
+            last = atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+bool CpuTopology::ReadFile(std::string const& path, std::string & out)
+{
+    std::ifstream f(path);
+    if (!f)
+        return false;
+    std::getline(f, out);
+    return !f.bad();
+}
+
+} //namespace co
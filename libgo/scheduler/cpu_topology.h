@@ -0,0 +1,62 @@
+#pragma once
+#include "../common/config.h"
+#include <string>
+#include <vector>
+
+namespace co
+{
+
+// CPU拓扑: 哪些CPU是同一个物理核的SMT兄弟, 共享同一个末级缓存, 属于同一个NUMA节点.
+// Linux下启动时从/sys/devices/system读取一次, 其他平台或读取失败时所有CPU视为等距.
+// 调度线程之间偷协程时由近及远, 尽量不跨NUMA节点迁移协程.
+class CpuTopology
+{
+public:
+    // CPU之间的距离, 越小越近
+    enum Distance
+    {
+        same_core = 0,      // 同一个CPU或者同一个物理核的SMT兄弟
+        same_llc = 1,       // 共享末级缓存
+        same_node = 2,      // 同一个NUMA节点
+        remote = 3,         // 跨节点或未知
+    };
+
+    static CpuTopology& getInstance();
+
+    // 两个CPU之间的距离, 未知的CPU(小于0)视为remote
+    Distance GetDistance(int cpu1, int cpu2) const;
+
+    // CPU所在的NUMA节点, 未知时返回-1
+    int NodeOf(int cpu) const;
+
+    // 是否读到了拓扑信息
+    bool IsKnown() const { return !cpus_.empty(); }
+
+    // 当前线程所在的CPU, 不支持时返回-1
+    static int CurrentCpu();
+
+private:
+    CpuTopology();
+
+    CpuTopology(CpuTopology const&) = delete;
+    CpuTopology& operator=(CpuTopology const&) = delete;
+
+    void Load();
+
+    // 解析"0-3,8,10-11"格式的CPU列表
+    static std::vector<int> ParseCpuList(std::string const& s);
+
+    static bool ReadFile(std::string const& path, std::string & out);
+
+    struct CpuInfo
+    {
+        int core = -1;      // 以SMT兄弟中编号最小的CPU标识物理核
+        int llc = -1;       // 以共享末级缓存的CPU中编号最小的标识缓存
+        int node = -1;
+    };
+
+    // 以CPU编号为下标
+    std::vector<CpuInfo> cpus_;
+};
+
+} //namespace co
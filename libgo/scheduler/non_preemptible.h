@@ -0,0 +1,37 @@
+#pragma once
+#include "../common/config.h"
+#include "processer.h"
+
+namespace co
+{
+
+/// 禁止异步抢占当前协程(见CoroutineOptions::preempt_time_slice_us), 可以嵌套
+// 协程中持有std::mutex等非协程锁、访问线程局部变量等不能被切走的临界区用它包住:
+//   {
+//       co::NonPreemptible np;
+//       std::lock_guard<std::mutex> lock(mtx);
+//       ...
+//   }
+// 只影响异步抢占, 临界区内主动yield或挂起仍然会切换协程. 不在协程中时什么也不做.
+class NonPreemptible
+{
+    Task* tk_;
+
+public:
+    NonPreemptible() : tk_(Processer::GetCurrentTask())
+    {
+        if (tk_) ++ tk_->noPreempt_;
+    }
+
+    ~NonPreemptible()
+    {
+        if (tk_) -- tk_->noPreempt_;
+    }
+
+    NonPreemptible(NonPreemptible const&) = delete;
+    NonPreemptible& operator=(NonPreemptible const&) = delete;
+};
+
+typedef NonPreemptible co_non_preemptible;
+
+} //namespace co
@@ -1,9 +1,16 @@
 #include "processer.h"
 #include "scheduler.h"
+#include "task_group.h"
+#include "cpu_topology.h"
 #include "../common/error.h"
 #include "../common/clock.h"
 #include <assert.h>
+#include <algorithm>
 #include "ref.h"
+#if defined(LIBGO_SYS_Linux)
+#include <link.h>
+#include <ucontext.h>
+#endif
 
 namespace co {
 
@@ -13,8 +20,6 @@ Processer::Processer(Scheduler * scheduler, int id)
     : scheduler_(scheduler), id_(id)
 {
     printf("[Processer] constructor\n");
-
-    waitQueue_.setLock(&runnableQueue_.LockRef());
 }
 
 Processer* & Processer::GetCurrentProcesser()
@@ -34,25 +39,33 @@ void Processer::AddTask(Task *tk)
     printf("[Processer::AddTask] task-%d add into proc(%u)\n", tk->id_, id_);
 
     DebugPrint(dbg_task | dbg_scheduler, "task(%s) add into proc(%u)(%p)", tk->DebugInfo(), id_, (void*)this);
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    newQueue_.pushWithoutLock(tk);
-    newQueue_.AssertLink();
-    if (waiting_)
-        cv_.notify_all();
-    else
-        notified_ = true;
+    load_.value.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
+        newQueue_.pushWithoutLock(tk);
+        newQueue_.AssertLink();
+        if (waiting_)
+            cv_.notify_all();
+        else
+            notified_ = true;
+    }
+    if (retired_) Rehome();
 }
 
 void Processer::AddTask(SList<Task> && slist)
 {
     DebugPrint(dbg_scheduler, "task(num=%d) add into proc(%u)", (int)slist.size(), id_);
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    newQueue_.pushWithoutLock(std::move(slist));
-    newQueue_.AssertLink();
-    if (waiting_)
-        cv_.notify_all();
-    else
-        notified_ = true;
+    load_.value.fetch_add((uint32_t)slist.size(), std::memory_order_relaxed);
+    {
+        std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
+        newQueue_.pushWithoutLock(std::move(slist));
+        newQueue_.AssertLink();
+        if (waiting_)
+            cv_.notify_all();
+        else
+            notified_ = true;
+    }
+    if (retired_) Rehome();
 }
 
 void Processer::NotifyCondition()
@@ -73,12 +86,41 @@ void Processer::Process()
     printf("Processer::Process Start! \n");
     GetCurrentProcesser() = this;
 
+#if defined(LIBGO_SYS_Linux)
+    nativeThread_ = pthread_self();
+    nativeThreadReady_ = true;
+#endif
+
 #if defined(LIBGO_SYS_Windows)
     FiberScopedGuard sg;
 #endif
 
+    struct RcuOnlineGuard
+    {
+        RcuReader & reader;
+
+        explicit RcuOnlineGuard(RcuReader & r) : reader(r)
+        {
+            Rcu::Register(&reader, true);
+            Rcu::Online(reader);
+        }
+
+        ~RcuOnlineGuard() { Rcu::Unregister(&reader); }
+    } rcuGuard(rcuReader_);
+
     while (!scheduler_->IsStop())
     {
+        if (retiring_) {
+            Retire();
+            break;
+        }
+
+        cpu_ = CpuTopology::CurrentCpu();
+        DrainInbound();
+        UpdateLoad();
+        bool grouped = TaskGroup::Enabled();
+        if (grouped)
+            BeginGroupPass();
         runnableQueue_.front(runningTask_);
 
         if (!runningTask_) {
@@ -98,6 +140,15 @@ void Processer::Process()
 
         addNewQuota_ = 1;
         while (runningTask_ && !scheduler_->IsStop()) {
+            TaskGroup* group = runningTask_->group_;
+            if (grouped) {
+                GroupState & gs = GetGroupState(group);
+                if (!IsGroupEligible(gs)) {
+                    DeferRunningTask(gs);
+                    continue;
+                }
+            }
+
             runningTask_->state_ = TaskState::runnable;
             runningTask_->proc_ = this;
 
@@ -108,6 +159,11 @@ void Processer::Process()
 #endif
 
             ++switchCount_;
+            Rcu::QuiescentState(rcuReader_);
+
+            if (runningTask_ != handoffTask_)
+                handoffQuota_ = 64;
+            handoffTask_ = nullptr;
 
             switch (runningTask_->state_) {
                 case TaskState::runnable:
@@ -121,7 +177,15 @@ void Processer::Process()
                         break;
             }
 
+            yieldBudget_ = CoroutineOptions::getInstance().maybe_yield_budget;
+            int64_t swapInTime = grouped ? NowNanosecond() : 0;
+            inTask_ = 1;
             runningTask_->SwapIn();
+            inTask_ = 0;
+            UpdateLoad();
+            // 切出后协程可能已在其他线程上被唤醒, 只使用切入前取得的group
+            if (grouped)
+                ChargeGroup(group, NowNanosecond() - swapInTime);
 
 #if ENABLE_DEBUGGER
             DebugPrint(dbg_switch, "leave task(%s) state=%d", runningTask_->DebugInfo(), (int)runningTask_->state_);
@@ -133,6 +197,8 @@ void Processer::Process()
                         printf("After Run - Task-%d, runnable\n", runningTask_->id_);
                         std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
                         auto next = (Task*)runningTask_->next;
+                        if (!next && DrainInboundWithoutLock())
+                            next = (Task*)runningTask_->next;
                         if (next) {
                             runningTask_ = next;
                             runningTask_->check_ = runnableQueue_.check_;
@@ -158,6 +224,10 @@ void Processer::Process()
                 case TaskState::block:
                     {
                         printf("After Run - Task-%d, block\n", runningTask_->id_);
+                        // 在BlockingRegion中挂起: 本线程已经空出来了, 区域提前结束
+                        if (blocking_)
+                            LeaveBlocking(runningTask_);
+
                         std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
                         runningTask_ = nextTask_;
                         nextTask_ = nullptr;
@@ -207,9 +277,17 @@ bool Processer::IsCoroutine()
     return !!GetCurrentTask();
 }
 
+bool Processer::HasOtherRunnable()
+{
+    auto proc = GetCurrentProcesser();
+    if (!proc || !proc->runningTask_) return false;
+    // runnableQueue_中包含正在执行的协程自己
+    return proc->RunnableSize() > 1;
+}
+
 std::size_t Processer::RunnableSize()
 {
-    return runnableQueue_.size() + newQueue_.size();
+    return runnableQueue_.size() + newQueue_.size() + deferredCount_;
 }
 
 void Processer::WaitCondition()
@@ -223,8 +301,12 @@ void Processer::WaitCondition()
     }
 
     waiting_ = true;
+    idleSince_ = NowMicrosecond();
     DebugPrint(dbg_scheduler, "WaitCondition. [Proc(%d)] --------------------------", id_);
+    Rcu::Offline(rcuReader_);
     cv_.wait(lock);
+    Rcu::Online(rcuReader_);
+    idleSince_ = 0;
     waiting_ = false;
 }
 
@@ -246,6 +328,7 @@ bool Processer::AddNewTasks()
 
 bool Processer::IsBlocking()
 {
+    if (blocking_) return true;
     if (!markSwitch_ || markSwitch_ != switchCount_) return false;
     return NowMicrosecond() > markTick_ + CoroutineOptions::getInstance().cycle_timeout_us;
 }
@@ -258,6 +341,238 @@ void Processer::Mark()
     }
 }
 
+bool Processer::MaybeYieldSlow()
+{
+    auto & opt = CoroutineOptions::getInstance();
+    yieldBudget_ = opt.maybe_yield_budget;
+
+    if (opt.maybe_yield_slice_us) {
+        // 每用完一次预算才读一次时钟. 本次调度中第一次检查时记下起点.
+        int64_t now = NowMicrosecond();
+        if (sliceSwitch_ != switchCount_) {
+            sliceSwitch_ = switchCount_;
+            sliceStart_ = now;
+            return false;
+        }
+        if (now - sliceStart_ < (int64_t)opt.maybe_yield_slice_us)
+            return false;
+    }
+
+    // 持有libgo内部锁时不能切出
+    if (PreemptOffDepth() > 0) return false;
+
+    CoYield();
+    return true;
+}
+
+bool Processer::NeedPreempt()
+{
+    uint32_t slice = CoroutineOptions::getInstance().preempt_time_slice_us;
+    if (!slice || !inTask_) return false;
+    if (!markSwitch_ || markSwitch_ != switchCount_) return false;
+    return NowMicrosecond() > markTick_ + slice;
+}
+
+#if defined(LIBGO_SYS_Linux)
+namespace {
+
+// 主程序的代码段. 只在主程序代码中抢占, 不在libc等动态库(malloc, stdio等持有内部锁)和vdso中抢占.
+struct PreemptibleText
+{
+    uintptr_t begin[8];
+    uintptr_t end[8];
+    int n = 0;
+};
+
+PreemptibleText & GetPreemptibleText()
+{
+    static PreemptibleText text;
+    return text;
+}
+
+int CollectMainText(struct dl_phdr_info* info, size_t, void*)
+{
+    PreemptibleText & text = GetPreemptibleText();
+    for (int i = 0; i < info->dlpi_phnum && text.n < 8; ++i) {
+        const ElfW(Phdr) & phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X)) continue;
+        text.begin[text.n] = info->dlpi_addr + phdr.p_vaddr;
+        text.end[text.n] = text.begin[text.n] + phdr.p_memsz;
+        ++text.n;
+    }
+    return 1;   // 第一个是主程序
+}
+
+// 只能排除libc和其他共享库中的代码. libgo静态链接时与主程序在同一个text段里,
+// 所以libgo自己的内部锁都要计入PreemptOffDepth(LFLock, RuntimeMutex), 不能依赖这里.
+bool IsPreemptiblePC(void* context)
+{
+    ucontext_t* uc = (ucontext_t*)context;
+#if defined(__x86_64__)
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    return false;
+#endif
+
+    PreemptibleText & text = GetPreemptibleText();
+    for (int i = 0; i < text.n; ++i)
+        if (pc >= text.begin[i] && pc < text.end[i])
+            return true;
+    return false;
+}
+
+} //namespace
+
+void Processer::InstallPreemptHandler()
+{
+    static std::once_flag once;
+    std::call_once(once, []{
+            dl_iterate_phdr(&CollectMainText, nullptr);
+
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_sigaction = &Processer::PreemptSignalHandler;
+            // 在信号处理函数中切出协程, 不屏蔽本信号, 以免调度线程之后收不到抢占信号
+            sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGURG, &sa, nullptr);
+            DebugPrint(dbg_scheduler, "Install preempt signal handler");
+            });
+}
+
+void Processer::PreemptSignalHandler(int, siginfo_t*, void* context)
+{
+    // 安全点: 在协程中, 不在BlockingRegion中, 协程允许抢占, 没有持有libgo内部锁, 正在执行主程序代码.
+    // 协程已经标记挂起或结束(还没切出)时也不能抢占, 否则调度线程会把这次切出当作挂起或结束.
+    Processer* proc = GetCurrentProcesser();
+    if (!proc || !proc->inTask_ || proc->blocking_) return;
+
+    Task* tk = proc->runningTask_;
+    if (!tk || tk->state_ != TaskState::runnable || tk->noPreempt_ || PreemptOffDepth() > 0) return;
+    if (!IsPreemptiblePC(context)) return;
+
+    // 信号帧保存了全部寄存器, 从这里切出协程, 恢复执行时从信号处理函数返回到被打断的地方.
+    // 协程可能被偷到其他线程上恢复.
+    int savedErrno = errno;
+    proc->inTask_ = 0;
+    ++ tk->yieldCount_;
+    tk->SwapOut();
+    errno = savedErrno;
+}
+#endif
+
+void Processer::Preempt()
+{
+#if defined(LIBGO_SYS_Linux)
+    if (!nativeThreadReady_) return;
+    InstallPreemptHandler();
+    pthread_kill(nativeThread_, SIGURG);
+#endif
+}
+
+int64_t Processer::NowNanosecond()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(FastSteadyClock::now().time_since_epoch()).count();
+}
+
+Processer::GroupState & Processer::GetGroupState(TaskGroup* group)
+{
+    std::size_t id = group ? group->Id() : 0;
+    if (groups_.empty() || !groups_[id].used) {
+        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+        if (groups_.empty())
+            groups_.resize(TaskGroup::kMaxGroups);
+        groups_[id].used = true;
+        usedGroups_.push_back(id);
+    }
+    return groups_[id];
+}
+
+void Processer::BeginGroupPass()
+{
+    int64_t granularity = (int64_t)CoroutineOptions::getInstance().task_group_granularity_us * 1000;
+
+    std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+
+    // 上一轮可执行的组和还有协程被移出的组中最小的虚拟运行时间, 单调递增
+    bool found = false;
+    int64_t minVruntime = 0;
+    for (std::size_t id : usedGroups_) {
+        GroupState & gs = groups_[id];
+        if (gs.pass != groupPass_ && gs.deferred.empty()) continue;
+        if (!found || gs.vruntime < minVruntime)
+            minVruntime = gs.vruntime;
+        found = true;
+    }
+    if (found && minVruntime > minVruntime_)
+        minVruntime_ = minVruntime;
+    ++ groupPass_;
+
+    while (deferredCount_) {
+        for (std::size_t id : usedGroups_) {
+            GroupState & gs = groups_[id];
+            if (gs.deferred.empty() || gs.vruntime > minVruntime_ + granularity) continue;
+            deferredCount_ -= gs.deferred.size();
+            runnableQueue_.pushWithoutLock(std::move(gs.deferred));
+        }
+
+        if (!runnableQueue_.emptyUnsafe())
+            break;
+
+        // 可执行的组都没有协程了, 推进到被移出的组中最小的, 避免有协程时调度线程进入等待
+        bool first = true;
+        for (std::size_t id : usedGroups_) {
+            GroupState & gs = groups_[id];
+            if (gs.deferred.empty()) continue;
+            if (first || gs.vruntime < minVruntime_)
+                minVruntime_ = gs.vruntime;
+            first = false;
+        }
+    }
+}
+
+bool Processer::IsGroupEligible(GroupState & gs)
+{
+    int64_t granularity = (int64_t)CoroutineOptions::getInstance().task_group_granularity_us * 1000;
+    if (gs.pass != groupPass_) {
+        // 本轮第一次遇到这个组: 刚变为可执行的组不能凭借空闲时落后的虚拟运行时间长时间独占
+        gs.pass = groupPass_;
+        if (gs.vruntime < minVruntime_ - granularity)
+            gs.vruntime = minVruntime_ - granularity;
+    }
+    return gs.vruntime <= minVruntime_ + granularity;
+}
+
+void Processer::DeferRunningTask(GroupState & gs)
+{
+    std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+    Task* tk = runningTask_;
+    runnableQueue_.nextWithoutLock(tk, runningTask_);
+    runnableQueue_.eraseWithoutLock(tk, false, false);
+    gs.deferred.append(SList<Task>(tk, tk, 1));
+    ++ deferredCount_;
+    DebugPrint(dbg_scheduler, "task(%s) deferred by task group", tk->DebugInfo());
+}
+
+void Processer::ChargeGroup(TaskGroup* group, int64_t ns)
+{
+    if (!group) group = TaskGroup::Default();
+    group->AddCpuTime(ns);
+    GetGroupState(group).vruntime += ns * TaskGroup::kDefaultWeight / group->Weight();
+}
+
+SList<Task> Processer::TakeDeferredWithoutLock()
+{
+    SList<Task> slist;
+    for (std::size_t id : usedGroups_)
+        slist.append(std::move(groups_[id].deferred));
+    deferredCount_ = 0;
+    return slist;
+}
+
 int64_t Processer::NowMicrosecond()
 {
     return std::chrono::duration_cast<std::chrono::microseconds>(FastSteadyClock::now().time_since_epoch()).count();
@@ -274,6 +589,7 @@ SList<Task> Processer::Steal(std::size_t n)
             return slist;
 
         std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+        DrainInboundWithoutLock();
         bool pushRunningTask = false, pushNextTask = false;
         if (runningTask_)
             pushRunningTask = runnableQueue_.eraseWithoutLock(runningTask_, true) || slist.erase(runningTask_, newQueue_.check_);
@@ -297,12 +613,15 @@ SList<Task> Processer::Steal(std::size_t n)
         newQueue_.AssertLink();
 
         std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+        // 阻塞的调度线程没机会取出被唤醒的协程, 一并偷走
+        DrainInboundWithoutLock();
         bool pushRunningTask = false, pushNextTask = false;
         if (runningTask_)
             pushRunningTask = runnableQueue_.eraseWithoutLock(runningTask_, true) || slist.erase(runningTask_, newQueue_.check_);
         if (nextTask_)
             pushNextTask = runnableQueue_.eraseWithoutLock(nextTask_, true) || slist.erase(nextTask_, newQueue_.check_);
         auto slist2 = runnableQueue_.pop_allWithoutLock();
+        slist2.append(TakeDeferredWithoutLock());
         if (pushRunningTask)
             runnableQueue_.pushWithoutLock(runningTask_);
         if (pushNextTask)
@@ -349,57 +668,318 @@ Processer::SuspendEntry Processer::SuspendBySelf(Task* tk)
     assert(tk->state_ == TaskState::runnable);
 
     tk->state_ = TaskState::block;
-    uint64_t id = ++ TaskRefSuspendId(tk);
 
     std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
     runnableQueue_.nextWithoutLock(runningTask_, nextTask_);
     runnableQueue_.eraseWithoutLock(runningTask_, false, false);
+    lock.unlock();
+
+    // 离开runnable队列之后才生成新的挂起标识, 唤醒者CAS成功时协程一定已不在任何队列中
+    uint64_t seq = ++ TaskRefSuspendId(tk);
 
     DebugPrint(dbg_suspend, "tk(%s) Suspend. nextTask(%s)", tk->DebugInfo(), nextTask_->DebugInfo());
-    waitQueue_.pushWithoutLock(runningTask_, false);
-    return SuspendEntry{ WeakPtr<Task>(tk), id };
+    return SuspendEntry{ TaskTable::MakeHandle(tk->slot_, seq) };
 }
 
 bool Processer::IsExpire(SuspendEntry const& entry)
 {
-    IncursivePtr<Task> tkPtr = entry.tk_.lock();
-    if (!tkPtr) return true;
-    if (entry.id_ != TaskRefSuspendId(tkPtr.get())) return true;
-    return false;
+    return !entry || !TaskTable::IsSuspended(entry.id_);
 }
 
-bool Processer::Wakeup(SuspendEntry const& entry, std::function<void()> const& functor)
+bool Processer::Wakeup(SuspendEntry const& entry, std::function<void()> const& functor,
+        bool handoff)
 {
-    IncursivePtr<Task> tkPtr = entry.tk_.lock();
-    if (!tkPtr) return false;
+    if (!entry) return false;
+
+    if (!functor && !handoff) {
+        WakeupBatch* batch = WakeupBatch::Current();
+        if (batch)
+            return batch->Add(entry);
+    }
+
+    // 挂起标识只有一个唤醒者能CAS成功, 成功后协程在被放回队列之前不会执行, 也不会被销毁
+    Task* tk = TaskTable::TryResume(entry.id_);
+    if (!tk) return false;
 
-    auto proc = tkPtr->proc_;
-    return proc ? proc->WakeupBySelf(tkPtr, entry.id_, functor) : false;
+    assert(tk->proc_);
+    if (functor)
+        functor();
+
+    Processer* waker = GetCurrentProcesser();
+    if (waker && (handoff || CoroutineOptions::getInstance().wakeup_run_next)
+            && waker->TryRunNext(tk, handoff))
+        return true;
+
+    tk->proc_->WakeupBySelf(tk);
+    return true;
 }
 
-bool Processer::WakeupBySelf(IncursivePtr<Task> const& tkPtr, uint64_t id, std::function<void()> const& functor)
+bool Processer::TryRunNext(Task* tk, bool handoff)
 {
-    Task* tk = tkPtr.get();
+    // 只在本调度线程正在执行的协程中, 并且不在BlockingRegion中
+    if (!inTask_ || blocking_) return false;
 
-    if (id != TaskRefSuspendId(tk)) return false;
+    // 不迁移其他Processer上的协程: CAS成功时它可能还没从原来的线程上切出,
+    // 原来的线程切出后也还要读它的state_和next
+    if (tk->proc_ != this) return false;
 
-    std::unique_lock<TaskQueue::lock_t> lock(waitQueue_.LockRef());
-    if (id != TaskRefSuspendId(tk)) return false;
-    ++ TaskRefSuspendId(tk);
-    if (functor)
-        functor();
-    bool ret = waitQueue_.eraseWithoutLock(tk, false, false);
-    (void)ret;
-    assert(ret);
-    size_t sizeAfterPush = runnableQueue_.pushWithoutLock(tk, false);
-    DebugPrint(dbg_suspend, "tk(%s) Wakeup. tk->state_ = %s. is-in-proc(%d). sizeAfterPush=%lu",
-            tk->DebugInfo(), GetTaskStateName(tk->state_), GetCurrentProcesser() == this, sizeAfterPush);
-    if (sizeAfterPush == 1 && GetCurrentProcesser() != this) {
-        lock.unlock();
+    std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+    if (handoffQuota_ <= 0 || !runningTask_ || runningTask_->check_ != runnableQueue_.check_)
+        return false;
+
+    // run-next只有一个位置, handoff可以继续插队
+    if (handoffTask_ && !handoff)
+        return false;
+
+    // 当前协程仍在runnable队列中, 放在它后面, 下一个执行
+    -- handoffQuota_;
+    handoffTask_ = tk;
+    DebugPrint(dbg_suspend, "tk(%s) Wakeup into run-next of proc(%d).", tk->DebugInfo(), id_);
+    runnableQueue_.insertAfterWithoutLock(runningTask_, tk, false);
+    return true;
+}
+
+void Processer::WakeupBySelf(Task* tk)
+{
+    if (blocking_ && GetCurrentProcesser() != this && tk != blockingTask_) {
+        // 本线程正阻塞在BlockingRegion中, 不等调度线程来偷.
+        // 在区域内挂起的协程本身不转交: 它可能还没有从本线程上切出
+        Processer* target = blockingTarget_;
+        if (target) {
+            DebugPrint(dbg_suspend, "tk(%s) Wakeup into proc(%d) for blocking proc(%d)",
+                    tk->DebugInfo(), target->id_, id_);
+            target->AddTask(SList<Task>(tk, tk, 1));
+            return ;
+        }
+    }
+
+    // 入栈后协程随时可能在别的线程上执行完并销毁, 之后不能再访问tk
+    DebugPrint(dbg_suspend, "tk(%s) Wakeup. tk->state_ = %s. is-in-proc(%d)",
+            tk->DebugInfo(), GetTaskStateName(tk->state_), GetCurrentProcesser() == this);
+    if (PushInbound(tk, tk) && GetCurrentProcesser() != this)
         NotifyCondition();
+    if (retired_) Rehome();
+}
+
+std::size_t Processer::WakeupItemsBySelf(WakeupItem* first, WakeupItem* last)
+{
+    // 先串成一条链, 再一次压入inbound栈
+    Task* head = nullptr;
+    Task* tail = first->tk;
+    for (WakeupItem* item = first; item != last; ++item) {
+        item->tk->wakeupNext_ = head;
+        head = item->tk;
+    }
+
+    std::size_t n = last - first;
+    DebugPrint(dbg_suspend, "Proc(%d) batch wakeup %lu tasks", id_, n);
+    if (PushInbound(head, tail) && GetCurrentProcesser() != this)
+        NotifyCondition();
+    if (retired_) Rehome();
+    return n;
+}
+
+bool Processer::PushInbound(Task* first, Task* last)
+{
+    // 入栈和整栈取出都是seq_cst: 入栈后读到retired_为false时, 退出的调度线程之后的整栈取出一定能看到
+    Task* top = inbound_.load(std::memory_order_relaxed);
+    do {
+        last->wakeupNext_ = top;
+    } while (!inbound_.compare_exchange_weak(top, first,
+                std::memory_order_seq_cst, std::memory_order_relaxed));
+    return top == nullptr;
+}
+
+std::size_t Processer::DrainInbound()
+{
+    if (!inbound_.load(std::memory_order_relaxed)) return 0;
+
+    std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
+    return DrainInboundWithoutLock();
+}
+
+std::size_t Processer::DrainInboundWithoutLock()
+{
+    if (!inbound_.load(std::memory_order_relaxed)) return 0;
+
+    // 整栈取出, 没有单个出栈, 不存在ABA问题; 栈顶是最后唤醒的, 反转后按唤醒顺序入队
+    Task* top = inbound_.exchange(nullptr, std::memory_order_seq_cst);
+    Task* head = nullptr;
+    while (top) {
+        Task* next = top->wakeupNext_;
+        top->wakeupNext_ = head;
+        head = top;
+        top = next;
+    }
+
+    std::size_t n = 0;
+    while (head) {
+        Task* tk = head;
+        head = tk->wakeupNext_;
+        tk->wakeupNext_ = nullptr;
+        runnableQueue_.pushWithoutLock(tk, false);
+        ++n;
+    }
+    return n;
+}
+
+bool Processer::EnterBlocking()
+{
+    assert(GetCurrentProcesser() == this);
+    assert(!blocking_);
+
+    Processer* target = scheduler_->FindBlockingTarget(this);
+    if (!target) return false;
+
+    // 先不接受新协程, 并标记阻塞, 之后被唤醒的协程直接交给target
+    blockingTarget_ = target;
+    blockingTask_ = runningTask_;
+    active_ = false;
+    blocking_ = true;
+
+    // 偷走除自己以外的全部协程(包括已唤醒还在inbound栈中的)
+    auto tasks = Steal(0);
+    DebugPrint(dbg_scheduler, "Proc(%d) enter blocking region, handoff %d tasks to proc(%d)",
+            id_, (int)tasks.size(), target->id_);
+    if (!tasks.empty())
+        target->AddTask(std::move(tasks));
+    return true;
+}
+
+void Processer::RequestRetire()
+{
+    active_ = false;
+    retiring_ = true;
+    NotifyCondition();
+}
+
+void Processer::Retire()
+{
+    assert(GetCurrentProcesser() == this);
+
+    // 先标记退出再交出协程, 之后交来的协程由交出者看到retired_后转交
+    retired_ = true;
+    retiring_ = false;
+    active_ = false;
+#if defined(LIBGO_SYS_Linux)
+    nativeThreadReady_ = false;
+#endif
+    Rehome();
+    GC();
+    DebugPrint(dbg_scheduler, "Proc(%d) retired after idle", id_);
+}
+
+void Processer::Rehome()
+{
+    if (!retired_) return;
+
+    auto tasks = Steal(0);
+    if (tasks.empty()) return;
+
+    // 0号P(调用Start的线程)从不退出
+    Processer* target = scheduler_->FindBlockingTarget(this);
+    if (!target) {
+        RcuReadLock lock;
+        target = scheduler_->processers_.Get()[0];
     }
+    DebugPrint(dbg_scheduler, "Proc(%d) retired, rehome %d tasks to proc(%d)",
+            id_, (int)tasks.size(), target->id_);
+    target->AddTask(std::move(tasks));
+}
+
+void Processer::Revive(bool active)
+{
+    assert(exited_);
+    exited_ = false;
+    retiring_ = false;
+    markSwitch_ = 0;
+    markTick_ = 0;
+    idleSince_ = 0;
+    notified_ = false;
+    retired_ = false;
+    active_ = active;
+}
+
+void Processer::LeaveBlocking(Task* tk)
+{
+    // 区域已经因为挂起而结束, 本P可能又被别的协程带入了新的区域
+    Task* expected = tk;
+    if (!blockingTask_.compare_exchange_strong(expected, nullptr))
+        return ;
+
+    // 仍保持非激活状态, 作为备用线程, 由调度线程按需重新激活
+    blocking_ = false;
+    blockingTarget_ = nullptr;
+    DebugPrint(dbg_scheduler, "Proc(%d) leave blocking region", id_);
+}
+
+WakeupBatch* & WakeupBatch::CurrentRef()
+{
+    static thread_local WakeupBatch* batch = nullptr;
+    return batch;
+}
+
+WakeupBatch* WakeupBatch::Current()
+{
+    return CurrentRef();
+}
+
+WakeupBatch::WakeupBatch()
+    : prev_(CurrentRef())
+{
+    CurrentRef() = this;
+    ++ PreemptOffDepth();
+}
+
+WakeupBatch::~WakeupBatch()
+{
+    CurrentRef() = prev_;
+    Commit();
+    -- PreemptOffDepth();
+}
+
+bool WakeupBatch::Add(Processer::SuspendEntry const& entry)
+{
+    if (Processer::IsExpire(entry)) return false;
+
+    items_.push_back(Processer::WakeupItem{entry.id_, nullptr, nullptr});
     return true;
 }
 
-} //namespace co
+std::size_t WakeupBatch::Commit()
+{
+    if (items_.empty()) return 0;
+
+    std::vector<Processer::WakeupItem> items;
+    items.swap(items_);
+
+    // 先结束挂起, 去掉已失效的(已被唤醒或重复加入的)
+    auto end = std::remove_if(items.begin(), items.end(),
+            [](Processer::WakeupItem & item) {
+                item.tk = TaskTable::TryResume(item.id);
+                if (!item.tk) return true;
+                item.proc = item.tk->proc_;
+                return false;
+            });
+    items.erase(end, items.end());
 
+    // 按目标Processer分组, 组内保持唤醒的先后顺序
+    std::stable_sort(items.begin(), items.end(),
+            [](Processer::WakeupItem const& lhs, Processer::WakeupItem const& rhs) {
+                return lhs.proc < rhs.proc;
+            });
+
+    std::size_t n = 0;
+    Processer::WakeupItem* first = items.data();
+    Processer::WakeupItem* last = first + items.size();
+    while (first != last) {
+        Processer::WakeupItem* next = first + 1;
+        while (next != last && next->proc == first->proc)
+            ++next;
+        n += first->proc->WakeupItemsBySelf(first, next);
+        first = next;
+    }
+    return n;
+}
+
+} //namespace co
@@ -2,7 +2,11 @@
 #include "../common/config.h"
 #include "../common/clock.h"
 #include "../task/task.h"
+#include "../task/task_table.h"
 #include "../common/ts_queue.h"
+#include "../common/timer.h"
+#include "../sync/rcu.h"
+#include "processer_array.h"
 
 #if ENABLE_DEBUGGER
 #include "../debug/listener.h"
@@ -10,16 +14,25 @@
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <vector>
+#if defined(LIBGO_SYS_Linux)
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 namespace co {
 
 class Scheduler;
+class WakeupBatch;
+class BlockingRegion;
 
 // 协程执行器
 // 对应一个线程, 负责本线程的协程调度, 非线程安全.
 class Processer
 {
     friend class Scheduler;
+    friend class WakeupBatch;
+    friend class BlockingRegion;
 
 private:
     Scheduler * scheduler_;
@@ -31,6 +44,26 @@ private:
     // 非激活的P仅仅是不能接受新的协程加入, 仍然可以强行AddTask并正常处理.
     volatile bool active_ = true;
 
+    // 正在执行的协程(blockingTask_)处于BlockingRegion中, 其余协程已交给blockingTarget_
+    // 期间被唤醒的其他协程也直接交给blockingTarget_. blockingTask_在区域内挂起时, 区域随之结束.
+    std::atomic_bool blocking_{false};
+    std::atomic<Processer*> blockingTarget_{nullptr};
+    std::atomic<Task*> blockingTask_{nullptr};
+
+    // 空闲收缩(见CoroutineOptions::idle_thread_exit_us)
+    // retiring_: 调度线程要求本线程退出; retired_: 已不再执行协程, 之后交给它的协程由交出者转交给其他P;
+    // exited_: 线程已经结束, 可以复用这个Processer. Processer对象本身从不销毁, 其他线程可以一直持有指针.
+    std::atomic_bool retiring_{false};
+    std::atomic_bool retired_{false};
+    std::atomic_bool exited_{false};
+
+    // 开始空闲等待的时间戳(微秒), 不在等待时为0
+    volatile int64_t idleSince_ = 0;
+
+    // 待执行协程数的估计, 放置新协程时无锁读取(见LoadEstimate)
+    // 调度线程每次切换协程时写入队列长度, AddTask先加上放入的数量.
+    PaddedLoad load_;
+
     // 当前正在运行的协程
     Task* runningTask_{nullptr};
     Task* nextTask_{nullptr};
@@ -38,6 +71,12 @@ private:
     // 每轮调度只加有限次数新协程, 防止新协程创建新协程产生死循环
     int addNewQuota_ = 0;
 
+    // 连续的直接交接(handoff)次数有上限, 防止互相唤醒的协程饿死队列中的其他协程.
+    // 调度到一个不是交接来的协程时重置.
+    // handoffTask_同时是run-next位置: 当前协程本次执行中已经放到它后面的协程, 每次调度开始时清空.
+    int handoffQuota_ = 0;
+    Task* handoffTask_{nullptr};
+
     // 当前正在运行的协程本次调度开始的时间戳(Dispatch线程专用)
     volatile int64_t markTick_ = 0;
     volatile uint64_t markSwitch_ = 0;
@@ -45,14 +84,56 @@ private:
     // 协程调度次数
     volatile uint64_t switchCount_ = 0;
 
+    // 调度线程最近一次所在的CPU(每轮调度开始时更新), 用于由近及远地偷协程, 未知时为-1
+    volatile int cpu_ = -1;
+
+    // 正在执行协程(SwapIn期间), 异步抢占只发生在协程中
+    volatile int inTask_ = 0;
+
+    // co_maybe_yield的次数预算, 每次切换协程时重置, 用完后检查时间片
+    int yieldBudget_ = 0;
+
+    // co_maybe_yield看到的本次调度开始的时间戳
+    uint64_t sliceSwitch_ = 0;
+    int64_t sliceStart_ = 0;
+
+#if defined(LIBGO_SYS_Linux)
+    // 调度线程, 用于发送抢占信号
+    pthread_t nativeThread_;
+    volatile bool nativeThreadReady_ = false;
+#endif
+
+    // 调度线程作为RCU的读者, 每次切换协程都经过一次静止状态, 空闲等待时离线
+    RcuReader rcuReader_;
+
     // 协程队列
     typedef TSQueue<Task, true> TaskQueue;
     TaskQueue runnableQueue_;
-    TaskQueue waitQueue_;
     TSQueue<Task, false> gcQueue_;
 
     TaskQueue newQueue_;
 
+    // 任务组调度(见TaskGroup), 创建过任务组后才启用
+    // 本调度线程上每个组的虚拟运行时间, 以及领先过多而暂时移出runnable队列的协程.
+    // 移出的协程只在调度线程上放回, 被steal时要持有runnable队列的锁.
+    struct GroupState
+    {
+        int64_t vruntime = 0;       // 按权重折算的执行时长(纳秒)
+        uint64_t pass = 0;          // 最近一次在本调度线程上可执行的轮次
+        bool used = false;
+        SList<Task> deferred;
+    };
+    std::vector<GroupState> groups_;        // 以TaskGroup::Id()为下标
+    std::vector<std::size_t> usedGroups_;
+    int64_t minVruntime_ = 0;
+    uint64_t groupPass_ = 0;
+    volatile std::size_t deferredCount_ = 0;
+
+    // 被唤醒的协程
+    // 挂起的协程不在任何队列中, 只由suspendId_标识. 唤醒者CAS suspendId_成功后把协程压入这个无锁栈,
+    // 调度线程在每轮调度的间隙一次取出并放入runnable队列. 唤醒不再和调度线程争抢runnable队列的锁.
+    std::atomic<Task*> inbound_{nullptr};
+
     // 等待的条件变量
     std::condition_variable_any cv_;
     std::atomic_bool waiting_{false};
@@ -75,23 +156,32 @@ public:
     // 是否在协程中
     static bool IsCoroutine();
 
+    // 当前调度线程上是否还有其他待执行的协程(不在协程中时返回false)
+    static bool HasOtherRunnable();
+
     // 协程切出
     ALWAYS_INLINE static void StaticCoYield();
 
+    // 有预算的让出: 当前协程本次调度的时间片用完才切出, 否则只是一次计数器自减.
+    // 适合在解析、压缩等长循环中每次迭代都调用. 返回是否切出了.
+    // 预算和时间片见CoroutineOptions::maybe_yield_budget, maybe_yield_slice_us.
+    ALWAYS_INLINE static bool MaybeYield();
+
     // 挂起标识
+    // TaskTable中的(槽位号, 挂起序号), 不持有协程的引用, 校验只需读一次槽位中的挂起序号.
     struct SuspendEntry {
-        WeakPtr<Task> tk_;
         uint64_t id_;
 
-        explicit operator bool() const { return !!tk_; }
+        SuspendEntry() : id_(0) {}
+        explicit SuspendEntry(uint64_t id) : id_(id) {}
+
+        explicit operator bool() const { return id_ != 0; }
 
         friend bool operator==(SuspendEntry const& lhs, SuspendEntry const& rhs) {
-            return lhs.tk_ == rhs.tk_ && lhs.id_ == rhs.id_;
+            return lhs.id_ == rhs.id_;
         }
 
         friend bool operator<(SuspendEntry const& lhs, SuspendEntry const& rhs) {
-            if (lhs.id_ == rhs.id_)
-                return lhs.tk_ < rhs.tk_;
             return lhs.id_ < rhs.id_;
         }
 
@@ -108,7 +198,15 @@ public:
     static SuspendEntry Suspend(FastSteadyClock::time_point timepoint);
 
     // 唤醒协程
-    static bool Wakeup(SuspendEntry const& entry, std::function<void()> const& functor = NULL);
+    // 本线程上有WakeupBatch作用域时, 不带functor和handoff的唤醒推迟到作用域结束时批量执行,
+    // 此时返回值表示加入批量时entry是否有效.
+    // 在协程中唤醒同一个Processer上的协程时(CoroutineOptions::wakeup_run_next), 被唤醒的协程放入run-next位置:
+    // 紧跟在当前协程之后执行, 接着用完当前协程剩下的时间片, 生产者/消费者这样互相唤醒的协程缓存是热的.
+    // 其他Processer上的协程不迁移过来, 回到原来的Processer排队.
+    // run-next只有一个位置, 本次执行中已经放过一个时, 之后唤醒的协程按普通方式排队.
+    // @handoff: 即使run-next位置已被占用或者关闭了wakeup_run_next, 也让同一个Processer上被唤醒的协程紧跟在当前协程之后执行.
+    static bool Wakeup(SuspendEntry const& entry, std::function<void()> const& functor = NULL,
+            bool handoff = false);
 
     // 测试一个SuspendEntry是否还可能有效
     static bool IsExpire(SuspendEntry const& entry);
@@ -122,8 +220,20 @@ private:
     // 暂兼用于负载指数
     std::size_t RunnableSize();
 
+    // 待执行的协程数量的估计, 不加锁, 可能略微过时
+    ALWAYS_INLINE std::size_t LoadEstimate() { return load_.value.load(std::memory_order_relaxed); }
+
+    // 刷新负载计数, 只在本调度线程调用
+    ALWAYS_INLINE void UpdateLoad()
+    {
+        load_.value.store((uint32_t)(runnableQueue_.sizeUnsafe() + newQueue_.sizeUnsafe() + deferredCount_),
+                std::memory_order_relaxed);
+    }
+
     ALWAYS_INLINE void CoYield();
 
+    bool MaybeYieldSlow();
+
     // 新创建、阻塞后触发的协程add进来
     void AddTask(Task *tk);
 
@@ -135,6 +245,15 @@ private:
 
     void NotifyCondition();
 
+    // 要求空闲的调度线程退出, 由调度线程调用
+    void RequestRetire();
+
+    // 复用已退出的Processer, 由调度线程调用
+    void Revive(bool active);
+
+    // 已要求退出或已经退出
+    ALWAYS_INLINE bool IsRetired() { return retiring_ || retired_; }
+
     // 是否处于等待状态(无runnable协程)
     // 调度线程会尽量分配协程过来
     ALWAYS_INLINE bool IsWaiting() { return waiting_; }
@@ -145,6 +264,12 @@ private:
 
     // 偷协程
     SList<Task> Steal(std::size_t n);
+
+    // 当前协程连续执行超过了抢占时间片
+    bool NeedPreempt();
+
+    // 请求异步抢占当前协程(仅Linux)
+    void Preempt();
     /// --------------------------------------
 
 private:
@@ -161,7 +286,98 @@ private:
 
     SuspendEntry SuspendBySelf(Task* tk);
 
-    bool WakeupBySelf(IncursivePtr<Task> const& tkPtr, uint64_t id, std::function<void()> const& functor);
+    // 已经CAS结束挂起的协程, 放回本Processer
+    void WakeupBySelf(Task* tk);
+
+    // 已经CAS结束挂起的本Processer上的协程放入run-next位置, 只能在本Processer执行的协程中调用
+    bool TryRunNext(Task* tk, bool handoff);
+
+    // 批量唤醒中属于这个Processer的一组
+    struct WakeupItem
+    {
+        uint64_t id;
+        Task* tk;
+        Processer* proc;
+    };
+
+    std::size_t WakeupItemsBySelf(WakeupItem* first, WakeupItem* last);
+
+    // 把[first, last]链(以wakeupNext_链接, last最先唤醒)压入inbound栈, 返回压入前是否为空
+    bool PushInbound(Task* first, Task* last);
+
+    // 取出inbound栈中的协程, 按唤醒顺序放入runnable队列. 返回取出的数量.
+    std::size_t DrainInbound();
+    std::size_t DrainInboundWithoutLock();
+
+    // 任务组调度
+    GroupState & GetGroupState(TaskGroup* group);
+
+    // 每轮调度开始时推进最小虚拟运行时间, 放回已经追上的组的协程
+    void BeginGroupPass();
+
+    // 组的虚拟运行时间没有领先过多
+    bool IsGroupEligible(GroupState & gs);
+
+    // 把runningTask_移出runnable队列, runningTask_指向它的下一个协程
+    void DeferRunningTask(GroupState & gs);
+
+    void ChargeGroup(TaskGroup* group, int64_t ns);
+
+    SList<Task> TakeDeferredWithoutLock();
+
+    static int64_t NowNanosecond();
+
+    // 退出调度: 交出剩余的协程, 之后不再执行协程
+    void Retire();
+
+    // 已退出调度时, 把队列中的协程(退出后才交来的)转交给其他P
+    void Rehome();
+
+    // 进入/退出BlockingRegion
+    // LeaveBlocking可以在任意线程上调用: 区域内挂起过的协程可能在其他调度线程上恢复执行
+    bool EnterBlocking();
+    void LeaveBlocking(Task* tk);
+
+#if defined(LIBGO_SYS_Linux)
+    static void InstallPreemptHandler();
+
+    static void PreemptSignalHandler(int sig, siginfo_t* info, void* context);
+#endif
+};
+
+// 批量唤醒
+// 作用域内本线程的Processer::Wakeup(不带functor和handoff)先收集起来, Commit或析构时按目标Processer分组,
+// 每组只用一次CAS压入inbound栈, 最多通知一次. 用于一次唤醒大量协程的场合(广播, 关闭channel, 大量fd就绪, 定时器).
+// 可以嵌套, 内层作用域结束时只提交自己收集的. 作用域内不能切换协程.
+class WakeupBatch
+{
+    std::vector<Processer::WakeupItem> items_;
+    WakeupBatch* prev_;
+
+public:
+    WakeupBatch();
+    ~WakeupBatch();
+
+    WakeupBatch(WakeupBatch const&) = delete;
+    WakeupBatch& operator=(WakeupBatch const&) = delete;
+
+    // entry已失效时返回false
+    bool Add(Processer::SuspendEntry const& entry);
+
+    // 执行收集到的唤醒, 返回实际唤醒的协程数量
+    std::size_t Commit();
+
+    // 本线程当前的批量唤醒作用域, 没有时返回nullptr
+    static WakeupBatch* Current();
+
+private:
+    static WakeupBatch* & CurrentRef();
+};
+
+// 调度器的定时器: 同一次触发的超时唤醒合并为一次批量唤醒
+template <>
+struct TimerTriggerScope<std::function<void()>> : public WakeupBatch
+{
 };
 
 ALWAYS_INLINE void Processer::StaticCoYield()
@@ -170,6 +386,14 @@ ALWAYS_INLINE void Processer::StaticCoYield()
     if (proc) proc->CoYield();
 }
 
+ALWAYS_INLINE bool Processer::MaybeYield()
+{
+    auto proc = GetCurrentProcesser();
+    if (!proc || !proc->inTask_) return false;
+    if (--proc->yieldBudget_ > 0) return false;
+    return proc->MaybeYieldSlow();
+}
+
 ALWAYS_INLINE void Processer::CoYield()
 {
     Task *tk = GetCurrentTask();
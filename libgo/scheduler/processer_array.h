@@ -0,0 +1,52 @@
+#pragma once
+#include "../common/config.h"
+#include "../sync/rcu.h"
+#include <atomic>
+#include <vector>
+
+namespace co
+{
+
+class Processer;
+
+// 独占一个缓存行的负载计数器
+// 前后各留一个缓存行的填充, 所在的缓存行里没有其他数据, 堆上分配时也不依赖对齐.
+struct PaddedLoad
+{
+    char before_[64];
+    std::atomic<uint32_t> value{0};
+    char after_[64];
+};
+
+/// 调度器的Processer数组(多读一写)
+// 写者(Start和dispatcher线程)每次增减都复制出一个新版本, 原子地发布, 旧版本在RCU宽限期之后释放.
+// 读者(AddTask, Stop, BlockingRegion等, 任意线程)在RcuReadLock内取快照: 一次原子读, 之后O(1)地取大小和按下标访问, 无锁.
+// 快照只包含没有退出的Processer, 按Id从小到大; 0号(调用Start的线程)从不退出, 总在第一个.
+// Processer对象本身从不释放, 读临界区结束后取到的Processer指针仍然有效.
+class ProcesserArray
+{
+public:
+    typedef std::vector<Processer*> Snapshot;
+
+    ProcesserArray() : snapshot_(new Snapshot) {}
+
+    ProcesserArray(ProcesserArray const&) = delete;
+    ProcesserArray& operator=(ProcesserArray const&) = delete;
+
+    // 返回的快照在读临界区结束之前有效. 写者读自己发布的版本时不需要读临界区.
+    ALWAYS_INLINE Snapshot const& Get() const
+    {
+        return *snapshot_.get();
+    }
+
+    // 发布新版本, 只能由写者调用
+    void Publish(Snapshot const& procs)
+    {
+        snapshot_.reset(new Snapshot(procs));
+    }
+
+private:
+    RcuPtr<Snapshot> snapshot_;
+};
+
+} //namespace co
@@ -11,7 +11,7 @@ TaskRefDefine(SourceLocation, Location)
 TaskRefDefine(std::string, DebugInfo)
 //TaskRefDefine(atomic_t<uint64_t>, SuspendId)
 
-#define TaskRefSuspendId(tk) tk->suspendId_
+#define TaskRefSuspendId(tk) TaskTable::Get(tk->slot_).suspendId
 
 inline const char* TaskDebugInfo(Task *tk)
 {
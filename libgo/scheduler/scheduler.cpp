@@ -1,4 +1,5 @@
 #include "scheduler.h"
+#include "cpu_topology.h"
 #include "../common/error.h"
 #include "../common/clock.h"
 #include <stdio.h>
@@ -7,6 +8,7 @@
 #include <time.h>
 #include "ref.h"
 #include <thread>
+#include <algorithm>
 
 namespace co
 {
@@ -17,9 +19,9 @@ inline atomic_t<unsigned long long> & GetTaskIdFactory()
     return factory;
 }
 
-std::mutex& ExitListMtx()
+RuntimeMutex& ExitListMtx()
 {
-    static std::mutex mtx;
+    static RuntimeMutex mtx;
     return mtx;
 }
 std::vector<std::function<void()>>* ExitList()
@@ -53,7 +55,7 @@ Scheduler* Scheduler::Create()
     (void)ignore;
 
     Scheduler* sched = new Scheduler;
-    std::unique_lock<std::mutex> lock(ExitListMtx());
+    std::unique_lock<RuntimeMutex> lock(ExitListMtx());
     auto vec = ExitList();
     vec->push_back([=] { delete sched; });
     return sched;
@@ -63,8 +65,9 @@ Scheduler::Scheduler()
 {
     printf("[Scheduler] Constructor!");
     LibgoInitialize();
-    processers_.push_back(new Processer(this, 0));
-    printf("processers_.push_back(new Processer(this, 0)); \n\n");
+    allProcessers_.push_back(new Processer(this, 0));
+    printf("allProcessers_.push_back(new Processer(this, 0)); \n\n");
+    PublishProcessers();
 }
 
 Scheduler::~Scheduler()
@@ -83,6 +86,10 @@ void Scheduler::CreateTask(TaskF const& fn, TaskOpt const& opt)
 
     printf("[Scheduler::CreateTask] new tk = %d \n", tk->id_);
     
+    // 没有指定任务组时继承创建者的
+    Task* creator = Processer::GetCurrentTask();
+    tk->group_ = opt.group_ ? opt.group_ : (creator ? creator->group_ : nullptr);
+
     TaskRefAffinity(tk) = opt.affinity_;
     TaskRefLocation(tk).Init(opt.file_, opt.lineno_);
     ++taskCount_;
@@ -128,13 +135,19 @@ void Scheduler::Start(int minThreadNumber, int maxThreadNumber)
     minThreadNumber_ = minThreadNumber;
     maxThreadNumber_ = maxThreadNumber;
 
-    auto mainProc = processers_[0];
+    auto mainProc = allProcessers_[0];
 
     for (int i = 0; i < minThreadNumber_ - 1; i++) {
         NewProcessThread();
     }
 
-    printf("minThreadNumber_: %d, processers_.size: %d\n", minThreadNumber_, processers_.size());
+    // 为BlockingRegion预先创建备用线程
+    for (uint32_t i = 0; i < CoroutineOptions::getInstance().blocking_spare_threads &&
+            (int)allProcessers_.size() < maxThreadNumber_; i++) {
+        NewProcessThread(false);
+    }
+
+    printf("minThreadNumber_: %d, allProcessers_.size: %d\n", minThreadNumber_, allProcessers_.size());
 
     // 唤醒协程的定时器线程
     if (timer_) {
@@ -146,8 +159,8 @@ void Scheduler::Start(int minThreadNumber, int maxThreadNumber)
         timerThread_.swap(t);
     }
 
-    // 调度线程
-    if (maxThreadNumber_ > 1) {
+    // 调度线程(同时负责发送异步抢占信号)
+    if (maxThreadNumber_ > 1 || CoroutineOptions::getInstance().preempt_time_slice_us) {
         DebugPrint(dbg_scheduler, "---> Create DispatcherThread");
         std::thread t([this]{
                 DebugPrint(dbg_thread, "Start dispatcher(sched=%p) thread id: %lu", (void*)this, NativeThreadID());
@@ -169,15 +182,15 @@ void Scheduler::goStart(int minThreadNumber, int maxThreadNumber)
 }
 void Scheduler::Stop()
 {
-    std::unique_lock<std::mutex> lock(stopMtx_);
+    std::unique_lock<RuntimeMutex> lock(stopMtx_);
 
     if (stop_) return;
 
     stop_ = true;
-    size_t n = processers_.size();
-    for (size_t i = 0; i < n; ++i) {
-        auto p = processers_[i];
-        if (p)
+    {
+        RcuReadLock rcuLock;
+        auto & procs = processers_.Get();
+        for (auto p : procs)
             p->NotifyCondition();
     }
 
@@ -214,7 +227,7 @@ static Scheduler::TimerType& staticGetTimer() {
             DebugPrint(dbg_thread, "Start global timer thread id: %lu", NativeThreadID());
             ptimer->ThreadRun();
             });
-    std::unique_lock<std::mutex> lock(ExitListMtx());
+    std::unique_lock<RuntimeMutex> lock(ExitListMtx());
     auto vec = ExitList();
     vec->push_back([=] {
             ptimer->Stop();
@@ -229,35 +242,159 @@ Scheduler::TimerType & Scheduler::StaticGetTimer() {
     return timer;
 }
 
-void Scheduler::NewProcessThread()
+Scheduler::idx_t Scheduler::NewProcessThread(bool active)
 {
-    auto p = new Processer(this, processers_.size());
-    DebugPrint(dbg_scheduler, "---> Create Processer(%d)", p->id_);
+    Processer* p = nullptr;
+    std::size_t pcount = allProcessers_.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        if (allProcessers_[i]->exited_) {
+            p = allProcessers_[i];
+            break;
+        }
+    }
+
+    bool reuse = !!p;
+    if (reuse) {
+        p->Revive(active);
+    } else {
+        p = new Processer(this, allProcessers_.size());
+        p->active_ = active;
+    }
+    DebugPrint(dbg_scheduler, "---> %s Processer(%d) active=%d", reuse ? "Reuse" : "Create", p->id_, (int)active);
     std::thread t([this, p]{
             DebugPrint(dbg_thread, "Start process(sched=%p) thread id: %lu", (void*)this, NativeThreadID());
             p->Process();
+            p->exited_ = true;
             });
     t.detach();
-    processers_.push_back(p);
+    if (!reuse)
+        allProcessers_.push_back(p);
+    PublishProcessers();
+    return p->id_;
+}
+
+void Scheduler::PublishProcessers()
+{
+    ProcesserArray::Snapshot procs;
+    procs.reserve(allProcessers_.size());
+    for (auto p : allProcessers_)
+        if (!p->exited_)
+            procs.push_back(p);
+    processers_.Publish(procs);
+}
+
+void Scheduler::RetireIdleProcesser()
+{
+    auto & opt = CoroutineOptions::getInstance();
+    if (!opt.idle_thread_exit_us)
+        return;
+
+    int spareLimit = (std::min)((int)opt.blocking_spare_threads, maxThreadNumber_ - minThreadNumber_);
+    int activeCount = 0, spareCount = 0;
+    std::size_t pcount = allProcessers_.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        auto p = allProcessers_[i];
+        if (p->IsRetired()) continue;
+        if (p->active_)
+            ++activeCount;
+        else if (!p->IsBlocking())
+            ++spareCount;
+    }
+
+    if (activeCount <= minThreadNumber_ && spareCount <= spareLimit)
+        return;
+
+    // 从后往前, 0号P(调用Start的线程)不退出
+    for (std::size_t i = pcount - 1; i > 0; --i) {
+        auto p = allProcessers_[i];
+        if (p->IsRetired() || p->blocking_ || !p->IsWaiting())
+            continue;
+
+        if (p->active_ ? activeCount <= minThreadNumber_ : spareCount <= spareLimit)
+            continue;
+
+        int64_t since = p->idleSince_;
+        if (!since || p->NowMicrosecond() - since < (int64_t)opt.idle_thread_exit_us)
+            continue;
+
+        DebugPrint(dbg_scheduler, "Retire idle processer(%d)", (int)i);
+        p->RequestRetire();
+        return;
+    }
+}
+
+Processer* Scheduler::FindBlockingTarget(Processer* self)
+{
+    // 同一类中选最近的
+    Processer* waiting = nullptr;
+    Processer* spare = nullptr;
+    Processer* lowest = nullptr;
+    std::size_t lowestLoad = 0;
+    RcuReadLock rcuLock;
+    auto & procs = processers_.Get();
+    for (auto p : procs) {
+        if (p == self || p->blocking_ || p->IsRetired()) continue;
+
+        if (p->active_) {
+            if (p->IsWaiting()) {
+                if (!waiting || Distance(self, p) < Distance(self, waiting))
+                    waiting = p;
+                continue;
+            }
+
+            std::size_t load = p->RunnableSize();
+            if (!lowest || load < lowestLoad ||
+                    (load == lowestLoad && Distance(self, p) < Distance(self, lowest))) {
+                lowest = p;
+                lowestLoad = load;
+            }
+        } else if (!p->IsBlocking()) {
+            if (!spare || Distance(self, p) < Distance(self, spare))
+                spare = p;
+        }
+    }
+
+    if (waiting)
+        return waiting;
+
+    if (spare) {
+        spare->active_ = true;
+        DebugPrint(dbg_scheduler, "Active spare processer(%d) for blocking processer(%d)", spare->id_, self->id_);
+        return spare;
+    }
+    return lowest;
+}
+
+int Scheduler::Distance(Processer* a, Processer* b)
+{
+    return CpuTopology::getInstance().GetDistance(a->cpu_, b->cpu_);
 }
 
 void Scheduler::DispatchBlocks(Scheduler::BlockMap &blockings,Scheduler::ActiveMap &actives)
 {
    if(blockings.size() == 0)
       return;
-   //将阻塞p的协程都steal出来
-   SList<Task> tasks;
+   //将阻塞p的协程都steal出来, 按来源分开, 分配时由近及远
+   std::vector<std::pair<Processer*, SList<Task>>> sources;
+   std::size_t stolen = 0;
    for (auto &kv : blockings) {
-        auto p = processers_[kv.first];
-        tasks.append(p->Steal(0));
+        auto p = allProcessers_[kv.first];
+        SList<Task> in = p->Steal(0);
+        if (in.empty())
+            continue;
+        stolen += in.size();
+        sources.emplace_back(p, std::move(in));
     }
     
-    if(tasks.empty())
+    if(!stolen)
        return;
+
+    std::vector<std::size_t> order(sources.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
    
-    ActiveMap newActives;
     //总协程数
-    std::size_t totalTasks = tasks.size();
+    std::size_t totalTasks = stolen;
     //需要平分协程p的数量
     std::size_t LowerNum = 0;
     //平分的协程数
@@ -283,26 +420,37 @@ void Scheduler::DispatchBlocks(Scheduler::BlockMap &blockings,Scheduler::ActiveM
     if(LowerP != actives.end())
        ++LowerP;
     
-    for(auto it = actives.begin(); it != LowerP; ++it)
+    for(auto it = actives.begin(); it != LowerP && stolen; ++it)
     {
-        SList<Task> in = tasks.cut(avg - it->first);
-        
-        if(in.empty())
-          break;
+        auto p = allProcessers_[it->second];
+        std::size_t need = avg > it->first ? avg - it->first : 0;
+        if (!need)
+            break;
 
-        auto p = processers_[it->second];
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) {
+                    return Distance(p, sources[lhs].first) < Distance(p, sources[rhs].first);
+                });
 
+        SList<Task> in;
+        for (std::size_t idx : order) {
+            if (in.size() >= need)
+                break;
+            in.append(sources[idx].second.cut(need - in.size()));
+        }
+        stolen -= in.size();
         p->AddTask(std::move(in));
     }
     //还剩下task就全都给最小的p
-    if(!tasks.empty())
+    if(stolen)
     {
-        auto p = processers_[actives.begin()->second];
-        p->AddTask(std::move(tasks));
+        auto p = allProcessers_[actives.begin()->second];
+        SList<Task> in;
+        for (auto & src : sources)
+            in.append(std::move(src.second));
+        p->AddTask(std::move(in));
     }
-
-    
 }
+
 void Scheduler::LoadBalance(Scheduler::ActiveMap &actives,std::size_t activeTasks)
 {
     
@@ -311,39 +459,55 @@ void Scheduler::LoadBalance(Scheduler::ActiveMap &actives,std::size_t activeTask
      if(actives.begin()->first > avg * CoroutineOptions::getInstance().load_balance_rate)
         return;
      
-     SList<Task> tasks;
+     //高于平均负载的p, 以及可以偷走的数量
+     std::vector<std::pair<Processer*, std::size_t>> donors;
+     std::size_t surplus = 0;
      for(auto it = actives.rbegin(); it != actives.rend(); ++it)
      {
           
           if(it->first <= avg)
              break;
 
-          auto p = processers_[it->second];
-
-          SList<Task> in = p->Steal(it->first - avg); 
-
-          tasks.append(std::move(in));
+          donors.emplace_back(allProcessers_[it->second], it->first - avg);
+          surplus += it->first - avg;
      }
 
-     if(tasks.empty())
+     if(donors.empty())
         return;
      
+     //低于平均负载的p由近及远地偷: 先SMT兄弟, 再同一末级缓存, 再同一NUMA节点, 最后跨节点.
+     //同样距离的按负载从高到低.
+     auto stealNearest = [&](Processer* p, std::size_t need) {
+         std::stable_sort(donors.begin(), donors.end(),
+                 [&](std::pair<Processer*, std::size_t> const& lhs, std::pair<Processer*, std::size_t> const& rhs) {
+                     return Distance(p, lhs.first) < Distance(p, rhs.first);
+                 });
+
+         SList<Task> tasks;
+         for (auto & donor : donors) {
+             if (!need)
+                 break;
+             std::size_t n = (std::min)(need, donor.second);
+             if (!n)
+                 continue;
+             donor.second -= n;
+             surplus -= n;
+             need -= n;
+             tasks.append(donor.first->Steal(n));
+         }
+         if (!tasks.empty())
+             p->AddTask(std::move(tasks));
+     };
+
      for(auto &kv : actives)
      {
-         if(kv.first >= avg)
+         if(kv.first >= avg || !surplus)
             break;
-         auto p = processers_[kv.second];
-
-         auto in = tasks.cut(avg - kv.first);
-             
-         p->AddTask(std::move(in));
-     }
-     //如果还剩下task,全都给最小的p
-     if(!tasks.empty())
-     {
-         auto p = processers_[actives.begin()->second];
-         p->AddTask(std::move(tasks));
+         stealNearest(allProcessers_[kv.second], avg - kv.first);
      }
+     //如果还剩下可以偷的,全都给最小的p
+     if(surplus)
+         stealNearest(allProcessers_[actives.begin()->second], surplus);
 }
 void Scheduler::DispatcherThread()
 {
@@ -353,14 +517,29 @@ void Scheduler::DispatcherThread()
         std::this_thread::sleep_for(std::chrono::microseconds(CoroutineOptions::getInstance().dispatcher_thread_cycle_us));
  
         // 1.收集负载值, 收集阻塞状态, 打阻塞标记, 唤醒处于等待状态但是有任务的P
-        idx_t pcount = processers_.size();
+        idx_t pcount = allProcessers_.size();
+
+        // 空闲退出的线程结束后, 从发布的数组中移除
+        std::size_t published = 0;
+        for (std::size_t i = 0; i < pcount; i++)
+            if (!allProcessers_[i]->exited_)
+                ++published;
+        if (published != processers_.Get().size())
+            PublishProcessers();
+
         std::size_t totalLoadaverage = 0;
         ActiveMap actives;
         BlockMap blockings;
 
         int isActiveCount = 0;
+        int liveCount = 0;
         for (std::size_t i = 0; i < pcount; i++) {
-            auto p = processers_[i];
+            auto p = allProcessers_[i];
+            //空闲退出的p不参与调度
+            if (p->IsRetired())
+                continue;
+            ++liveCount;
+
             //等待中的p不能算阻塞,无法加入新协程导致p饿死
             if (!p->IsWaiting() && p->IsBlocking()) {
                 blockings[i] = p->RunnableSize();
@@ -380,7 +559,10 @@ void Scheduler::DispatcherThread()
         
         std::size_t activeTasks = 0;
         for (std::size_t i = 0; i < pcount; i++) {
-            auto p = processers_[i];
+            auto p = allProcessers_[i];
+            if (p->IsRetired())
+                continue;
+
             std::size_t loadaverage = p->RunnableSize();
             totalLoadaverage += loadaverage;
 
@@ -403,15 +585,38 @@ void Scheduler::DispatcherThread()
             if (loadaverage > 0 && p->IsWaiting()) {
                 p->NotifyCondition();
             }
+
+            // 当前协程执行超过时间片, 抢占它(包括被判定为阻塞的P)
+            if (p->NeedPreempt()) {
+                DebugPrint(dbg_scheduler, "Preempt processer(%d)", (int)i);
+                p->Preempt();
+            }
         }
 
-        if (actives.empty() && (int)pcount < maxThreadNumber_) {
+        if (actives.empty() && liveCount < maxThreadNumber_) {
             // 全部阻塞, 并且还有协程待执行, 起新线程
-            NewProcessThread();
-            actives.insert(ActiveMap::value_type{0, pcount});
-            ++pcount;
+            actives.insert(ActiveMap::value_type{0, NewProcessThread()});
+            ++liveCount;
+        }
+
+        // 备用线程被BlockingRegion用掉后, 在后台补齐, 不在需要时才创建
+        if (liveCount < maxThreadNumber_) {
+            uint32_t spares = 0;
+            pcount = allProcessers_.size();
+            for (std::size_t i = 0; i < pcount; i++) {
+                auto p = allProcessers_[i];
+                if (!p->IsRetired() && !p->active_ && !p->IsBlocking())
+                    ++spares;
+            }
+            if (spares < CoroutineOptions::getInstance().blocking_spare_threads) {
+                NewProcessThread(false);
+                ++liveCount;
+            }
         }
 
+        // 多出来的调度线程空闲太久就退出
+        RetireIdleProcesser();
+
         
         // 全部阻塞并且不能起新线程, 无需调度, 等待即可
         if (actives.empty())
@@ -435,28 +640,89 @@ void Scheduler::AddTask(Task* tk)
         return ;
     }
 
-    proc = Processer::GetCurrentProcesser();
-    if (proc && proc->active_ && proc->GetScheduler() == this) {
-        proc->AddTask(tk);
+    Processer* local = Processer::GetCurrentProcesser();
+    if (local && (!local->active_ || local->GetScheduler() != this))
+        local = nullptr;
+
+    eTaskPlacement placement = CoroutineOptions::getInstance().task_placement;
+    if (placement == eTaskPlacement::local_first && local) {
+        local->AddTask(tk);
         return ;
     }
 
-    std::size_t pcount = processers_.size();
-    std::size_t idx = lastActive_;
-    for (std::size_t i = 0; i < pcount; ++i, ++idx) {
-        idx = idx % pcount;
-        proc = processers_[idx];
-        if (proc && proc->active_)
+    RcuReadLock rcuLock;
+    auto & procs = processers_.Get();
+    switch (placement) {
+        case eTaskPlacement::power_of_two:
+            proc = PickByTwoChoices(procs, local);
+            break;
+
+        case eTaskPlacement::round_robin:
+            proc = NextActive(procs, roundRobin_++);
+            break;
+
+        default:
+            proc = NextActive(procs, lastActive_);
             break;
     }
     proc->AddTask(tk);
 }
 
+// 线程局部的xorshift, 只用于采样
+static uint32_t FastRand()
+{
+    static thread_local uint32_t seed = 0;
+    if (!seed)
+        seed = (uint32_t)(uintptr_t)&seed ^ (uint32_t)NativeThreadID() ^ 0x9e3779b9;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+Processer* Scheduler::NextActive(ProcesserArray::Snapshot const& procs, std::size_t start)
+{
+    std::size_t pcount = procs.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        Processer* p = procs[(start + i) % pcount];
+        if (p->active_)
+            return p;
+    }
+
+    // 全部非激活, 仍然可以强行放入
+    return procs[start % pcount];
+}
+
+Processer* Scheduler::PickByTwoChoices(ProcesserArray::Snapshot const& procs, Processer* local)
+{
+    Processer* a = local ? local : NextActive(procs, FastRand());
+    if (procs.size() == 1)
+        return a;
+
+    Processer* b = NextActive(procs, FastRand());
+    if (b == a)
+        b = NextActive(procs, FastRand());
+
+    // 一样轻时留在本地(或第一个样本)
+    return b->LoadEstimate() < a->LoadEstimate() ? b : a;
+}
+
 uint32_t Scheduler::TaskCount()
 {
     return taskCount_;
 }
 
+uint32_t Scheduler::ThreadCount()
+{
+    uint32_t n = 0;
+    RcuReadLock rcuLock;
+    auto & procs = processers_.Get();
+    for (auto p : procs)
+        if (!p->IsRetired())
+            ++n;
+    return n;
+}
+
 uint64_t Scheduler::GetCurrentTaskID()
 {
     Task* tk = Processer::GetCurrentTask();
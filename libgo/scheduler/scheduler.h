@@ -1,11 +1,12 @@
 #pragma once
 #include "../common/config.h"
-#include "../common/deque.h"
 #include "../common/spinlock.h"
 #include "../common/timer.h"
 #include "../task/task.h"
 #include "../debug/listener.h"
 #include "processer.h"
+#include "processer_array.h"
+#include "task_group.h"
 #include <mutex>
 
 namespace co {
@@ -16,6 +17,7 @@ struct TaskOpt
     int lineno_ = 0;
     std::size_t stack_size_ = 0;
     const char* file_ = nullptr;
+    TaskGroup* group_ = nullptr;
 };
 
 // 协程调度器
@@ -59,6 +61,9 @@ public:
     // 当前调度器中的协程数量
     uint32_t TaskCount();
 
+    // 当前的调度线程数量(包括备用线程, 不包括空闲退出的)
+    uint32_t ThreadCount();
+
     // 当前协程ID, ID从1开始（不在协程中则返回0）
     uint64_t GetCurrentTaskID();
 
@@ -91,31 +96,61 @@ private:
 
     static void DeleteTask(RefObject* tk, void* arg);
 
-    // 将一个协程加入可执行队列中
+    // 将一个协程加入可执行队列中, 按CoroutineOptions::task_placement选择调度线程
     void AddTask(Task* tk);
 
+    // 从start开始(取模)的第一个激活的P, 都未激活时返回start处的, 在读临界区内调用
+    Processer* NextActive(ProcesserArray::Snapshot const& procs, std::size_t start);
+
+    // 随机两个激活的P(local不为空时其中一个是local)中负载较轻的, 在读临界区内调用
+    Processer* PickByTwoChoices(ProcesserArray::Snapshot const& procs, Processer* local);
+
     // dispatcher线程函数
     // 1.根据待执行协程计算负载, 将高负载的P中的协程steal一些给空载的P
     // 2.侦测到阻塞的P(单个协程运行时间超过阀值), 将P中的其他协程steal给其他P
     void DispatcherThread();
 
-    void NewProcessThread();
+    // @active: 为false时创建备用线程, 不接受新协程, 等待BlockingRegion或调度线程激活
+    // 优先复用空闲退出的Processer, 返回它的Id(allProcessers_中的下标)
+    idx_t NewProcessThread(bool active = true);
+
+    // 把没有退出的Processer发布到processers_
+    void PublishProcessers();
+
+    // 超出minThreadNumber的活跃P, 以及超出blocking_spare_threads的备用P, 空闲超过idle_thread_exit_us时退出.
+    // 每次最多退出一个. 线程结束后从processers_中移除, Processer对象留在allProcessers_中, 下次扩展时复用.
+    void RetireIdleProcesser();
 
+    // 为进入BlockingRegion的P找一个接手其余协程的P
+    // 依次选择: 空闲的活跃P, 空闲的备用P(将其激活), 负载最小的活跃P, 同一类中选距离最近的
+    Processer* FindBlockingTarget(Processer* self);
+
+    // 两个P所在CPU之间的距离(见CpuTopology)
+    static int Distance(Processer* a, Processer* b);
+
+    // 阻塞的P中的协程, 以及负载均衡时偷的协程, 都由近及远地分配
     void DispatchBlocks(BlockMap &blockings,ActiveMap &actives);
 
     void LoadBalance(ActiveMap &actives,std::size_t activeTasks);
     
     TimerType & StaticGetTimer();
 
-    // deque of Processer, write by start or dispatch thread
-    Deque<Processer*> processers_;
+    // 所有创建过的Processer, 下标即Processer::Id(), 只增不减.
+    // 只由写者(Start和dispatcher线程)访问, 其他线程读processers_.
+    std::vector<Processer*> allProcessers_;
 
-    LFLock started_;
+    // 发布给所有线程的Processer数组(见ProcesserArray)
+    ProcesserArray processers_;
+
+    LFFlag started_;
 
     atomic_t<uint32_t> taskCount_{0};
 
     volatile uint32_t lastActive_ = 0;
 
+    // eTaskPlacement::round_robin的游标
+    atomic_t<uint32_t> roundRobin_{0};
+
     TimerType *timer_ = nullptr;
     
     int minThreadNumber_ = 1;
@@ -125,7 +160,7 @@ private:
 
     std::thread timerThread_;
 
-    std::mutex stopMtx_;
+    RuntimeMutex stopMtx_;
 
     bool stop_ = false;
 };
@@ -0,0 +1,42 @@
+#include "task_group.h"
+#include <stdexcept>
+
+namespace co
+{
+
+TaskGroup::TaskGroup(std::string const& name, int weight, std::size_t id)
+    : name_(name), weight_(weight > 0 ? weight : 1), id_(id)
+{
+}
+
+std::atomic_bool & TaskGroup::EnabledRef()
+{
+    static std::atomic_bool enabled{false};
+    return enabled;
+}
+
+TaskGroup* TaskGroup::Default()
+{
+    static TaskGroup* obj = new TaskGroup("default", kDefaultWeight, 0);
+    return obj;
+}
+
+TaskGroup* TaskGroup::Create(std::string const& name, int weight)
+{
+    static std::atomic<std::size_t> nextId{1};
+    std::size_t id = nextId++;
+    if (id >= kMaxGroups)
+        throw std::logic_error("libgo too many task groups");
+
+    Default();
+    TaskGroup* group = new TaskGroup(name, weight, id);
+    EnabledRef() = true;
+    return group;
+}
+
+void TaskGroup::SetWeight(int weight)
+{
+    weight_.store(weight > 0 ? weight : 1, std::memory_order_relaxed);
+}
+
+} //namespace co
@@ -0,0 +1,74 @@
+#pragma once
+#include "../common/config.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace co
+{
+
+/// 任务组(租户、流量类别等)
+// 同一个调度器中的协程可以分属不同的任务组, 组之间按权重分享CPU时间, 组内仍按FIFO调度:
+//   co::TaskGroup* tenant = co::TaskGroup::Create("tenant-a", 2048);
+//   go co_group(tenant) []{ ... };
+// 每个调度线程上按组统计虚拟运行时间(执行时长 * 默认权重 / 组权重), 虚拟运行时间领先超过
+// CoroutineOptions::task_group_granularity_us的组, 其协程暂时移出runnable队列, 等其他组追上后再放回.
+// 一个组创建再多的协程也只能得到按权重的那一份, 不会饿死其他组.
+// 没有指定组的协程属于创建它的协程所在的组, 不在协程中创建的属于默认组.
+// 从未创建过任务组时不做任何统计. 任务组不会被销毁.
+class TaskGroup
+{
+public:
+    static const int kDefaultWeight = 1024;
+    static const std::size_t kMaxGroups = 256;
+
+    // 创建任务组, 超过kMaxGroups个时抛出std::logic_error
+    static TaskGroup* Create(std::string const& name, int weight = kDefaultWeight);
+
+    // 默认组
+    static TaskGroup* Default();
+
+    // 是否创建过任务组
+    ALWAYS_INLINE static bool Enabled()
+    {
+        return EnabledRef().load(std::memory_order_relaxed);
+    }
+
+    std::size_t Id() const { return id_; }
+
+    std::string const& Name() const { return name_; }
+
+    int Weight() const { return weight_.load(std::memory_order_relaxed); }
+
+    // 调整权重, 对之后的执行时长生效
+    void SetWeight(int weight);
+
+    // 组内协程累计的执行时长
+    std::chrono::nanoseconds CpuTime() const
+    {
+        return std::chrono::nanoseconds(cpuTime_.load(std::memory_order_relaxed));
+    }
+
+    // 由调度线程在协程切出后调用
+    void AddCpuTime(int64_t ns)
+    {
+        cpuTime_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+private:
+    TaskGroup(std::string const& name, int weight, std::size_t id);
+
+    TaskGroup(TaskGroup const&) = delete;
+    TaskGroup& operator=(TaskGroup const&) = delete;
+
+    static std::atomic_bool & EnabledRef();
+
+    std::string name_;
+    std::atomic<int> weight_;
+    std::size_t id_;
+    std::atomic<int64_t> cpuTime_{0};
+};
+
+typedef TaskGroup co_task_group;
+
+} //namespace co
@@ -0,0 +1,98 @@
+#pragma once
+#include "../common/config.h"
+#include "parking_lot.h"
+#include <functional>
+
+namespace co
+{
+
+/// 可重复使用的屏障(与C++20的std::barrier相同)
+// 一个字的状态: 阶段号(高24位) | 之后每个阶段的参与者数(20位) | 本阶段还没到达的数量(低20位).
+// 到达只有一次CAS; 最后一个到达者执行完成回调, 进入下一阶段, 并在ParkingLot中一次唤醒所有等待者.
+// 协程和原生线程都可以等待.
+class Barrier
+{
+public:
+    typedef uint32_t arrival_token;
+
+private:
+    static const int kCountBits = 20;
+    static const uint64_t kCountMask = (1ull << kCountBits) - 1;
+    static const int kExpectedShift = kCountBits;
+    static const int kPhaseShift = 2 * kCountBits;
+
+    atomic_t<uint64_t> state_;
+    std::function<void()> completion_;
+
+public:
+    explicit Barrier(std::size_t expected, std::function<void()> const& completion = NULL)
+        : state_((uint64_t)expected << kExpectedShift | expected), completion_(completion)
+    {
+        assert(expected > 0 && expected <= kCountMask);
+    }
+
+    Barrier(Barrier const&) = delete;
+    Barrier& operator=(Barrier const&) = delete;
+
+    // 到达但不等待, 返回本阶段的token
+    arrival_token arrive()
+    {
+        return arrive(false);
+    }
+
+    // 等待token所在的阶段结束
+    void wait(arrival_token token)
+    {
+        while (phase(state_.load(std::memory_order_acquire)) == token) {
+            ParkingLot::Park(this, [=]{
+                    return phase(state_.load(std::memory_order_relaxed)) == token;
+                    });
+        }
+    }
+
+    void arrive_and_wait()
+    {
+        wait(arrive(false));
+    }
+
+    // 到达并退出, 之后的阶段少一个参与者
+    void arrive_and_drop()
+    {
+        arrive(true);
+    }
+
+private:
+    static arrival_token phase(uint64_t state)
+    {
+        return (arrival_token)(state >> kPhaseShift);
+    }
+
+    arrival_token arrive(bool drop)
+    {
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            assert((state & kCountMask) > 0);
+            next = state - 1 - (drop ? (1ull << kExpectedShift) : 0);
+        } while (!state_.compare_exchange_weak(state, next,
+                    std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        arrival_token token = phase(state);
+        if (next & kCountMask)
+            return token;
+
+        // 最后一个到达: 其他参与者都在等待, 执行完成回调后进入下一阶段
+        if (completion_)
+            completion_();
+
+        uint64_t expected = (next >> kExpectedShift) & kCountMask;
+        state_.store((uint64_t)(arrival_token)(token + 1) << kPhaseShift |
+                expected << kExpectedShift | expected, std::memory_order_release);
+        ParkingLot::UnparkAll(this);
+        return token;
+    }
+};
+
+typedef Barrier co_barrier;
+
+} //namespace co
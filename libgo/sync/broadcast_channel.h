@@ -0,0 +1,538 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/clock.h"
+#include "../scheduler/processer.h"
+#include "co_condition_variable.h"
+#include <thread>
+
+namespace co
+{
+
+// 订阅者读得太慢, 环形缓冲区写满时的处理策略
+enum class lag_policy
+{
+    block,          // 发布者等待最慢的订阅者
+    drop_oldest,    // 覆盖最旧的消息, 慢的订阅者跳过被覆盖的部分
+    disconnect,     // 断开最慢的订阅者
+};
+
+/// 广播Channel
+// 1.一个消息只在共享的环形缓冲区中存一份, 每个订阅者有自己的读游标.
+// 2.发布时只加一次锁; 订阅者读取时不加锁, 只在没有新消息时才挂起.
+// 3.订阅者只能从订阅之后发布的消息开始读. 每个Subscriber只能被一个协程(或线程)读取.
+// 4.Close之后订阅者仍可读完剩余的消息.
+template <typename T>
+class BroadcastChannel
+{
+    typedef RuntimeMutex lock_t;
+    typedef FastSteadyClock::time_point time_point_t;
+
+    static const uint64_t kWriting = (uint64_t)-1;
+    static const uint64_t kEmpty = (uint64_t)-2;
+    static const uint64_t kDisconnected = (uint64_t)-1;
+
+    struct Slot
+    {
+        atomic_t<uint64_t> seq{kEmpty};
+        atomic_t<int> readers{0};       // 正在读取此slot的订阅者数
+        atomic_t<std::size_t> pending{0};   // 还未读取此消息的订阅者数
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* get() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    struct SubscriberState
+    {
+        atomic_t<uint64_t> cursor;      // 下一个要读的消息序号
+        atomic_t<uint64_t> dropped{0};  // 被覆盖而跳过的消息数
+
+        explicit SubscriberState(uint64_t c) : cursor(c) {}
+    };
+
+    struct Impl
+    {
+        const std::size_t capacity_;
+        const lag_policy policy_;
+        Slot* slots_;
+
+        atomic_t<uint64_t> tail_{0};    // 下一个发布的消息序号
+        atomic_t<bool> closed_{false};
+
+        lock_t lock_;
+        std::vector<SubscriberState*> subscribers_;
+        int waitingReaders_ = 0;
+        atomic_t<int> waitingPublishers_{0};
+        ConditionVariableAny readCv_;
+        ConditionVariableAny writeCv_;
+
+        Impl(std::size_t capacity, lag_policy policy)
+            : capacity_(capacity), policy_(policy)
+        {
+            assert(capacity_ > 0);
+            slots_ = new Slot[capacity_];
+        }
+
+        ~Impl()
+        {
+            for (std::size_t i = 0; i < capacity_; ++i) {
+                uint64_t seq = slots_[i].seq;
+                if (seq != kEmpty && seq != kWriting)
+                    slots_[i].get()->~T();
+            }
+            delete[] slots_;
+        }
+
+        Slot & slot(uint64_t seq) { return slots_[seq % capacity_]; }
+
+        // ---------------- 发布
+        bool Publish(T && t, bool bWait, time_point_t deadline)
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            for (;;) {
+                if (closed_) return false;
+
+                uint64_t seq = tail_.load(std::memory_order_relaxed);
+                Slot & s = slot(seq);
+                if (seq >= capacity_ && !makeRoom(lock, s, seq - capacity_, bWait, deadline))
+                    return false;
+
+                // makeRoom等待期间放开过锁, 其他发布者可能已经发布了这个序号
+                if (tail_.load(std::memory_order_relaxed) != seq)
+                    continue;
+
+                // 等待正在读取旧消息的订阅者离开.
+                // 订阅者读取期间不会被抢占, 但可能与本协程在同一个线程上, 所以放开锁让出协程再重试.
+                s.seq.store(kWriting, std::memory_order_seq_cst);
+                if (s.readers.load(std::memory_order_seq_cst)) {
+                    lock.unlock();
+                    yield();
+                    lock.lock();
+                    continue;
+                }
+
+                if (seq >= capacity_)
+                    s.get()->~T();
+                new (s.get()) T(std::move(t));
+                s.pending.store(subscribers_.size(), std::memory_order_relaxed);
+                s.seq.store(seq, std::memory_order_release);
+                tail_.store(seq + 1, std::memory_order_release);
+
+                if (waitingReaders_)
+                    readCv_.notify_all();
+                return true;
+            }
+        }
+
+        // 持有锁时调用: 按策略腾出oldSeq所在的slot
+        bool makeRoom(std::unique_lock<lock_t> & lock, Slot & s, uint64_t oldSeq,
+                bool bWait, time_point_t deadline)
+        {
+            if (policy_ == lag_policy::drop_oldest)
+                return true;
+
+            if (policy_ == lag_policy::disconnect && s.pending.load(std::memory_order_acquire)) {
+                for (std::size_t i = 0; i < subscribers_.size();) {
+                    SubscriberState* sub = subscribers_[i];
+                    uint64_t c = sub->cursor.load(std::memory_order_acquire);
+                    if (c <= oldSeq && sub->cursor.compare_exchange_strong(c, kDisconnected,
+                                std::memory_order_acq_rel, std::memory_order_acquire))
+                    {
+                        DebugPrint(dbg_channel, "Broadcast disconnect slow subscriber. cursor=%lu", (unsigned long)c);
+                        releasePending(c);
+                        subscribers_[i] = subscribers_.back();
+                        subscribers_.pop_back();
+                        continue;
+                    }
+                    ++i;
+                }
+
+                if (waitingReaders_)
+                    readCv_.notify_all();
+
+                // 与断开同时读完的订阅者马上会减掉pending
+                bWait = true;
+                deadline = time_point_t();
+            }
+
+            while (s.pending.load(std::memory_order_acquire)) {
+                if (closed_ || !bWait)
+                    return false;
+
+                waitingPublishers_.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!s.pending.load(std::memory_order_relaxed)) {
+                    waitingPublishers_.fetch_sub(1, std::memory_order_relaxed);
+                    break;
+                }
+
+                ConditionVariableAny::cv_status status;
+                if (deadline == time_point_t())
+                    status = writeCv_.wait(lock);
+                else
+                    status = writeCv_.wait_util(lock, deadline);
+                waitingPublishers_.fetch_sub(1, std::memory_order_relaxed);
+
+                if (status == ConditionVariableAny::cv_status::timeout)
+                    return !closed_ && !s.pending.load(std::memory_order_acquire);
+            }
+            return !closed_;
+        }
+
+        // 持有锁时调用: 替离开的订阅者减掉[cursor, tail_)内消息的pending
+        void releasePending(uint64_t cursor)
+        {
+            uint64_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail > capacity_)
+                cursor = (std::max)(cursor, tail - capacity_);
+            bool notify = false;
+            for (uint64_t seq = cursor; seq < tail; ++seq) {
+                Slot & s = slot(seq);
+                if (s.seq.load(std::memory_order_relaxed) == seq &&
+                        s.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    notify = true;
+            }
+
+            if (notify && waitingPublishers_.load(std::memory_order_relaxed))
+                writeCv_.notify_all();
+        }
+
+        // ---------------- 订阅
+        SubscriberState* Subscribe()
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            SubscriberState* sub = new SubscriberState(tail_.load(std::memory_order_relaxed));
+            subscribers_.push_back(sub);
+            return sub;
+        }
+
+        void Unsubscribe(SubscriberState* sub)
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            uint64_t c = sub->cursor.exchange(kDisconnected, std::memory_order_acq_rel);
+            if (c != kDisconnected) {
+                releasePending(c);
+                auto it = std::find(subscribers_.begin(), subscribers_.end(), sub);
+                if (it != subscribers_.end()) {
+                    *it = subscribers_.back();
+                    subscribers_.pop_back();
+                }
+            }
+            lock.unlock();
+            delete sub;
+        }
+
+        // 读一个消息, 读到的消息交给f访问(不拷贝)
+        template <typename F>
+        bool Read(SubscriberState* sub, F const& f, bool bWait, time_point_t deadline)
+        {
+            for (;;) {
+                uint64_t c = sub->cursor.load(std::memory_order_relaxed);
+                if (c == kDisconnected)
+                    return false;
+
+                uint64_t tail = tail_.load(std::memory_order_acquire);
+                if (c < tail) {
+                    if (tail - c > capacity_) {
+                        // 落后太多, 旧消息已被覆盖
+                        uint64_t oldest = tail - capacity_;
+                        if (sub->cursor.compare_exchange_weak(c, oldest,
+                                    std::memory_order_acq_rel, std::memory_order_relaxed))
+                            sub->dropped.fetch_add(oldest - c, std::memory_order_relaxed);
+                        continue;
+                    }
+
+                    // 读取期间不能被抢占, 否则发布者要一直等到本协程再次执行
+                    Slot & s = slot(c);
+                    ++ PreemptOffDepth();
+                    std::atomic_signal_fence(std::memory_order_seq_cst);
+                    s.readers.fetch_add(1, std::memory_order_seq_cst);
+                    if (s.seq.load(std::memory_order_seq_cst) != c) {
+                        // 正在被覆盖
+                        s.readers.fetch_sub(1, std::memory_order_release);
+                        std::atomic_signal_fence(std::memory_order_seq_cst);
+                        -- PreemptOffDepth();
+                        yield();
+                        continue;
+                    }
+
+                    f(*s.get());
+
+                    // 先减pending再离开slot, 保证减的是这个消息的pending
+                    bool notify = false;
+                    if (sub->cursor.compare_exchange_strong(c, c + 1,
+                                std::memory_order_acq_rel, std::memory_order_relaxed))
+                        notify = s.pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+                    s.readers.fetch_sub(1, std::memory_order_release);
+                    std::atomic_signal_fence(std::memory_order_seq_cst);
+                    -- PreemptOffDepth();
+
+                    if (notify) {
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        if (waitingPublishers_.load(std::memory_order_relaxed)) {
+                            std::unique_lock<lock_t> lock(lock_);
+                            writeCv_.notify_all();
+                        }
+                    }
+                    return true;
+                }
+
+                // 没有新消息
+                if (closed_.load(std::memory_order_acquire)) {
+                    if (c < tail_.load(std::memory_order_acquire))
+                        continue;
+                    return false;
+                }
+
+                if (!bWait)
+                    return false;
+
+                if (!park(sub, c, deadline))
+                    return false;
+            }
+        }
+
+        // 等待新消息, 返回false表示超时
+        bool park(SubscriberState* sub, uint64_t c, time_point_t deadline)
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            while (tail_.load(std::memory_order_relaxed) == c && !closed_ &&
+                    sub->cursor.load(std::memory_order_relaxed) != kDisconnected)
+            {
+                ++waitingReaders_;
+                ConditionVariableAny::cv_status status;
+                if (deadline == time_point_t())
+                    status = readCv_.wait(lock);
+                else
+                    status = readCv_.wait_util(lock, deadline);
+                --waitingReaders_;
+
+                if (status == ConditionVariableAny::cv_status::timeout)
+                    return tail_.load(std::memory_order_relaxed) != c || closed_;
+            }
+            return true;
+        }
+
+        void Close()
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            if (closed_) return ;
+            closed_ = true;
+            readCv_.notify_all();
+            writeCv_.notify_all();
+        }
+
+        std::size_t SubscriberCount()
+        {
+            std::unique_lock<lock_t> lock(lock_);
+            return subscribers_.size();
+        }
+
+        static void yield()
+        {
+            if (Processer::IsCoroutine())
+                Processer::StaticCoYield();
+            else
+                std::this_thread::yield();
+        }
+    };
+
+public:
+    // 订阅者, 析构时自动退订
+    class Subscriber
+    {
+        friend class BroadcastChannel;
+
+        std::shared_ptr<Impl> impl_;
+        SubscriberState* state_ = nullptr;
+
+        Subscriber(std::shared_ptr<Impl> const& impl)
+            : impl_(impl), state_(impl->Subscribe()) {}
+
+    public:
+        Subscriber() = default;
+        Subscriber(Subscriber && other)
+            : impl_(std::move(other.impl_)), state_(other.state_)
+        {
+            other.state_ = nullptr;
+        }
+
+        Subscriber& operator=(Subscriber && other)
+        {
+            if (this != &other) {
+                Unsubscribe();
+                impl_ = std::move(other.impl_);
+                state_ = other.state_;
+                other.state_ = nullptr;
+            }
+            return *this;
+        }
+
+        Subscriber(Subscriber const&) = delete;
+        Subscriber& operator=(Subscriber const&) = delete;
+
+        ~Subscriber() { Unsubscribe(); }
+
+        void Unsubscribe()
+        {
+            if (state_) {
+                impl_->Unsubscribe(state_);
+                state_ = nullptr;
+                impl_.reset();
+            }
+        }
+
+        // 拷贝出一个消息. 已Close且读完, 或被断开时返回false
+        bool Pop(T & t)
+        {
+            return Visit([&](T const& v){ t = v; });
+        }
+
+        Subscriber & operator>>(T & t)
+        {
+            Pop(t);
+            return *this;
+        }
+
+        bool TryPop(T & t)
+        {
+            return TryVisit([&](T const& v){ t = v; });
+        }
+
+        template <typename Rep, typename Period>
+        bool TimedPop(T & t, std::chrono::duration<Rep, Period> dur)
+        {
+            return TimedVisit([&](T const& v){ t = v; }, dur);
+        }
+
+        bool TimedPop(T & t, FastSteadyClock::time_point deadline)
+        {
+            return TimedVisit([&](T const& v){ t = v; }, deadline);
+        }
+
+        // 不拷贝, 直接访问共享缓冲区中的消息: f(T const&).
+        // f执行期间此slot不能被覆盖, 也不会被异步抢占, 所以f中不能切换协程, 也不要长时间阻塞.
+        template <typename F>
+        bool Visit(F const& f)
+        {
+            return state_ && impl_->Read(state_, f, true, time_point_t());
+        }
+
+        template <typename F>
+        bool TryVisit(F const& f)
+        {
+            return state_ && impl_->Read(state_, f, false, time_point_t());
+        }
+
+        template <typename F, typename Rep, typename Period>
+        bool TimedVisit(F const& f, std::chrono::duration<Rep, Period> dur)
+        {
+            return state_ && impl_->Read(state_, f, true, dur + FastSteadyClock::now());
+        }
+
+        template <typename F>
+        bool TimedVisit(F const& f, FastSteadyClock::time_point deadline)
+        {
+            return state_ && impl_->Read(state_, f, true, deadline);
+        }
+
+        // 是否因为太慢而被断开(lag_policy::disconnect)
+        bool Disconnected() const
+        {
+            return !state_ || state_->cursor.load(std::memory_order_relaxed) == kDisconnected;
+        }
+
+        // 因为太慢而跳过的消息数(lag_policy::drop_oldest)
+        uint64_t Dropped() const
+        {
+            return state_ ? state_->dropped.load(std::memory_order_relaxed) : 0;
+        }
+    };
+
+private:
+    std::shared_ptr<Impl> impl_;
+
+public:
+    // @capacity: 共享环形缓冲区的大小, 必须大于0
+    // @policy: 订阅者落后capacity个消息时的处理策略
+    explicit BroadcastChannel(std::size_t capacity, lag_policy policy = lag_policy::block)
+        : impl_(std::make_shared<Impl>(capacity, policy))
+    {
+    }
+
+    Subscriber Subscribe() const
+    {
+        return Subscriber(impl_);
+    }
+
+    BroadcastChannel const& operator<<(T const& t) const
+    {
+        Publish(t);
+        return *this;
+    }
+
+    BroadcastChannel const& operator<<(T && t) const
+    {
+        Publish(std::move(t));
+        return *this;
+    }
+
+    bool Publish(T const& t) const
+    {
+        return impl_->Publish(T(t), true, time_point_t());
+    }
+
+    bool Publish(T && t) const
+    {
+        return impl_->Publish(std::move(t), true, time_point_t());
+    }
+
+    template <typename ... Args>
+    bool Emplace(Args && ... args) const
+    {
+        return impl_->Publish(T(std::forward<Args>(args)...), true, time_point_t());
+    }
+
+    bool TryPublish(T const& t) const
+    {
+        return impl_->Publish(T(t), false, time_point_t());
+    }
+
+    bool TryPublish(T && t) const
+    {
+        return impl_->Publish(std::move(t), false, time_point_t());
+    }
+
+    template <typename Rep, typename Period>
+    bool TimedPublish(T const& t, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->Publish(T(t), true, dur + FastSteadyClock::now());
+    }
+
+    template <typename Rep, typename Period>
+    bool TimedPublish(T && t, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->Publish(std::move(t), true, dur + FastSteadyClock::now());
+    }
+
+    bool TimedPublish(T const& t, FastSteadyClock::time_point deadline) const
+    {
+        return impl_->Publish(T(t), true, deadline);
+    }
+
+    bool TimedPublish(T && t, FastSteadyClock::time_point deadline) const
+    {
+        return impl_->Publish(std::move(t), true, deadline);
+    }
+
+    void Close() const
+    {
+        impl_->Close();
+    }
+
+    std::size_t SubscriberCount() const
+    {
+        return impl_->SubscriberCount();
+    }
+};
+
+} //namespace co
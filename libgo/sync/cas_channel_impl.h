@@ -8,7 +8,7 @@ namespace co
 template <typename T>
 class CASChannelImpl : public ChannelImpl<T>
 {
-    typedef std::mutex lock_t;
+    typedef RuntimeMutex lock_t;
     typedef FastSteadyClock::time_point time_point_t;
     const std::size_t capacity_;
     bool closed_;
@@ -43,7 +43,7 @@ public:
     }
     
     // write
-    bool Push(T t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    bool Push(T && t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
     {
         DebugPrint(dbg_channel, "[id=%ld] Push ->", this->getId());
 
@@ -61,7 +61,7 @@ public:
                 if (!rq_.notify_one(
                             [&](Entry & entry)
                             {
-                                *entry.pvalue = t;
+                                *entry.pvalue = std::move(t);
                             }))
                 {
                     if (++spin >= kSpinCount) {
@@ -103,7 +103,7 @@ public:
         FakeLock lock;
         Entry entry;
         entry.id = GetCurrentCoroID();
-        entry.value = t;
+        entry.value = std::move(t);
         auto cond = [&](size_t size) -> typename cond_t::CondRet {
             typename cond_t::CondRet ret{true, true};
             if (closed_) {
@@ -127,9 +127,9 @@ public:
         };
         typename cond_t::cv_status cv_status;
         if (deadline == time_point_t())
-            cv_status = wq_.wait(lock, entry, cond);
+            cv_status = wq_.wait(lock, std::move(entry), cond);
         else
-            cv_status = wq_.wait_util(lock, deadline, entry, cond);
+            cv_status = wq_.wait_util(lock, deadline, std::move(entry), cond);
 
         switch ((int)cv_status) {
             case (int)cond_t::cv_status::no_timeout:
@@ -179,7 +179,7 @@ public:
                 if (!wq_.notify_one(
                             [&](Entry & entry)
                             {
-                                t = entry.value;
+                                t = std::move(entry.value);
                             }))
                 {
                     if (++spin >= kSpinCount) {
@@ -232,9 +232,9 @@ public:
         };
         typename cond_t::cv_status cv_status;
         if (deadline == time_point_t())
-            cv_status = rq_.wait(lock, entry, cond);
+            cv_status = rq_.wait(lock, std::move(entry), cond);
         else
-            cv_status = rq_.wait_util(lock, deadline, entry, cond);
+            cv_status = rq_.wait_util(lock, deadline, std::move(entry), cond);
 
         switch ((int)cv_status) {
             case (int)cond_t::cv_status::no_timeout:
@@ -275,6 +275,11 @@ public:
         dbg_mask_ = mask;
     }
 
+    void SetHandoff(bool b) {
+        wq_.setHandoff(b);
+        rq_.setHandoff(b);
+    }
+
     bool Empty()
     {
         return wq_.empty();
@@ -6,10 +6,16 @@
 #include "channel_impl.h"
 #include "cas_channel_impl.h"
 #include "locked_channel_impl.h"
+#include "spsc_channel_impl.h"
+#include "segmented_channel_impl.h"
 
 namespace co
 {
 
+// 构造单生产者单消费者Channel的标记
+struct spsc_t {};
+static const spsc_t spsc = {};
+
 template <typename T>
 class Channel
 {
@@ -19,15 +25,29 @@ private:
 public:
     // @capacity: capacity of channel.
     // @choose1: use CASChannelImpl if capacity less than choose1
-    // @choose2: if capacity less than choose2, use ringbuffer. else use std::list.
+    // @choose2: if capacity less than choose2, use ringbuffer. else use lock-free segmented queue.
+    //           capacity = (size_t)-1 means unbounded.
     explicit Channel(std::size_t capacity = 0,
             std::size_t choose1 = 0, //16,
             std::size_t choose2 = 100001)
     {
         if (capacity < choose1)
             impl_.reset(new CASChannelImpl<T>(capacity));
+        else if (capacity < choose2)
+            impl_.reset(new LockedChannelImpl<T>(capacity));
+        else
+            impl_.reset(new SegmentedChannelImpl<T>(capacity));
+    }
+
+    // 单生产者单消费者: 同一时刻只能有一个写者和一个读者, 其余接口与普通Channel一致.
+    // capacity为0时无法做到wait-free, 退化为普通Channel.
+    // e.g: co_chan<int> ch(1024, co::spsc);
+    Channel(std::size_t capacity, spsc_t)
+    {
+        if (capacity > 0)
+            impl_.reset(new SpscChannelImpl<T>(capacity));
         else
-            impl_.reset(new LockedChannelImpl<T>(capacity, capacity < choose2));
+            impl_.reset(new LockedChannelImpl<T>(capacity));
     }
 
     void SetDbgMask(uint64_t mask)
@@ -35,9 +55,23 @@ public:
         impl_->SetDbgMask(mask);
     }
 
-    Channel const& operator<<(T t) const
+    // 直接交接(默认关闭): 读写唤醒的对端如果与当前协程在同一个Processer上,
+    // 就让它紧跟在当前协程之后执行, 而不是排到runnable队列的末尾.
+    // 适合同一线程内的请求-应答(ping-pong), 一次切换就能完成一次往返.
+    void SetHandoff(bool b)
     {
-        impl_->Push(t, true);
+        impl_->SetHandoff(b);
+    }
+
+    Channel const& operator<<(T const& t) const
+    {
+        impl_->Push(T(t), true);
+        return *this;
+    }
+
+    Channel const& operator<<(T && t) const
+    {
+        impl_->Push(std::move(t), true);
         return *this;
     }
 
@@ -54,9 +88,27 @@ public:
         return *this;
     }
 
-    bool TryPush(T t) const
+    // 用args原地构造一个T并写入, 全程只有move, 没有拷贝
+    template <typename ... Args>
+    bool Emplace(Args && ... args) const
+    {
+        return impl_->Push(T(std::forward<Args>(args)...), true);
+    }
+
+    template <typename ... Args>
+    bool TryEmplace(Args && ... args) const
     {
-        return impl_->Push(t, false);
+        return impl_->Push(T(std::forward<Args>(args)...), false);
+    }
+
+    bool TryPush(T const& t) const
+    {
+        return impl_->Push(T(t), false);
+    }
+
+    bool TryPush(T && t) const
+    {
+        return impl_->Push(std::move(t), false);
     }
 
     bool TryPop(T & t) const
@@ -71,14 +123,25 @@ public:
     }
 
     template <typename Rep, typename Period>
-    bool TimedPush(T t, std::chrono::duration<Rep, Period> dur) const
+    bool TimedPush(T const& t, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->Push(T(t), true, dur + FastSteadyClock::now());
+    }
+
+    template <typename Rep, typename Period>
+    bool TimedPush(T && t, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->Push(std::move(t), true, dur + FastSteadyClock::now());
+    }
+
+    bool TimedPush(T const& t, FastSteadyClock::time_point deadline) const
     {
-        return impl_->Push(t, true, dur + FastSteadyClock::now());
+        return impl_->Push(T(t), true, deadline);
     }
 
-    bool TimedPush(T t, FastSteadyClock::time_point deadline) const
+    bool TimedPush(T && t, FastSteadyClock::time_point deadline) const
     {
-        return impl_->Push(t, true, deadline);
+        return impl_->Push(std::move(t), true, deadline);
     }
 
     template <typename Rep, typename Period>
@@ -105,6 +168,82 @@ public:
         return impl_->Pop(t, true, deadline);
     }
 
+    // ------------- 批量读写
+    // 批量写入: 一次加锁写入尽量多的数据, 并成批唤醒读者.
+    // values中的数据会被move走, 返回写入的个数, 只有Close时才会少于n.
+    std::size_t PushN(T* values, std::size_t n) const
+    {
+        return impl_->PushN(values, n, true);
+    }
+
+    // @c: 连续存储的容器(std::vector, std::array等)
+    template <typename Container>
+    std::size_t PushN(Container & c) const
+    {
+        return impl_->PushN(c.data(), c.size(), true);
+    }
+
+    std::size_t TryPushN(T* values, std::size_t n) const
+    {
+        return impl_->PushN(values, n, false);
+    }
+
+    template <typename Rep, typename Period>
+    std::size_t TimedPushN(T* values, std::size_t n, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->PushN(values, n, true, dur + FastSteadyClock::now());
+    }
+
+    std::size_t TimedPushN(T* values, std::size_t n, FastSteadyClock::time_point deadline) const
+    {
+        return impl_->PushN(values, n, true, deadline);
+    }
+
+    // 批量读取: 至多读max个, 等到有数据后一次取走所有可读的数据.
+    // 返回读到的个数, 只有Close时才会返回0.
+    std::size_t PopN(T* out, std::size_t max) const
+    {
+        return impl_->PopN(out, max, true);
+    }
+
+    // 读到的数据追加到out的尾部
+    std::size_t PopN(std::vector<T> & out, std::size_t max) const
+    {
+        return popNToVector(out, max, true, FastSteadyClock::time_point{});
+    }
+
+    std::size_t TryPopN(T* out, std::size_t max) const
+    {
+        return impl_->PopN(out, max, false);
+    }
+
+    std::size_t TryPopN(std::vector<T> & out, std::size_t max) const
+    {
+        return popNToVector(out, max, false, FastSteadyClock::time_point{});
+    }
+
+    template <typename Rep, typename Period>
+    std::size_t TimedPopN(T* out, std::size_t max, std::chrono::duration<Rep, Period> dur) const
+    {
+        return impl_->PopN(out, max, true, dur + FastSteadyClock::now());
+    }
+
+    std::size_t TimedPopN(T* out, std::size_t max, FastSteadyClock::time_point deadline) const
+    {
+        return impl_->PopN(out, max, true, deadline);
+    }
+
+    template <typename Rep, typename Period>
+    std::size_t TimedPopN(std::vector<T> & out, std::size_t max, std::chrono::duration<Rep, Period> dur) const
+    {
+        return popNToVector(out, max, true, dur + FastSteadyClock::now());
+    }
+
+    std::size_t TimedPopN(std::vector<T> & out, std::size_t max, FastSteadyClock::time_point deadline) const
+    {
+        return popNToVector(out, max, true, deadline);
+    }
+
     bool Unique() const
     {
         return impl_.unique();
@@ -124,6 +263,17 @@ public:
     {
         return impl_->Size();
     }
+
+private:
+    std::size_t popNToVector(std::vector<T> & out, std::size_t max,
+            bool bWait, FastSteadyClock::time_point deadline) const
+    {
+        std::size_t offset = out.size();
+        out.resize(offset + max);
+        std::size_t n = impl_->PopN(out.data() + offset, max, bWait, deadline);
+        out.resize(offset + n);
+        return n;
+    }
 };
 
 
@@ -10,10 +10,41 @@ struct ChannelImpl : public IdCounter<ChannelImpl<T>>
 {
     virtual ~ChannelImpl() {}
 
-    virtual bool Push(T t, bool bWait,
+    // 写入时move走t中的数据
+    virtual bool Push(T && t, bool bWait,
             FastSteadyClock::time_point deadline = FastSteadyClock::time_point{}) = 0;
+    // 读出时将数据move到t中
     virtual bool Pop(T & t, bool bWait,
             FastSteadyClock::time_point deadline = FastSteadyClock::time_point{}) = 0;
+
+    // 批量写入, 返回成功写入的个数(遇到满/超时/关闭即停止).
+    // 默认实现逐个写入, 子类可以重写成一次加锁写入多个.
+    virtual std::size_t PushN(T* values, std::size_t n, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        std::size_t i = 0;
+        for (; i < n; ++i)
+            if (!Push(std::move(values[i]), bWait, deadline))
+                break;
+        return i;
+    }
+
+    // 批量读取, 至多读max个, 返回读到的个数.
+    // bWait时只等待第一个数据, 之后有多少读多少, 不再等待.
+    virtual std::size_t PopN(T* out, std::size_t max, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        std::size_t i = 0;
+        for (; i < max; ++i)
+            if (!Pop(out[i], bWait && i == 0, deadline))
+                break;
+        return i;
+    }
+
+    // 直接交接: 唤醒的对端与当前协程在同一个Processer上时, 让它成为下一个执行的协程.
+    // 默认不支持, 忽略.
+    virtual void SetHandoff(bool) {}
+
     virtual void Close() = 0;
     virtual std::size_t Size() = 0;
     virtual bool Empty() = 0;
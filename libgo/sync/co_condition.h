@@ -0,0 +1,87 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/clock.h"
+#include "parking_lot.h"
+#include <condition_variable>
+
+namespace co
+{
+
+/// 协程条件变量(轻量版)
+// 只有一个字节, 等待者在ParkingLot中以this为key挂起, 没有等待者时notify只有一次原子读.
+// 可以配合任意锁使用(co_mutex, std::mutex...), 协程和原生线程都可以等待.
+class CoConditionVariable
+{
+    atomic_t<uint8_t> hasWaiters_{0};
+
+public:
+    CoConditionVariable() = default;
+    CoConditionVariable(CoConditionVariable const&) = delete;
+    CoConditionVariable& operator=(CoConditionVariable const&) = delete;
+
+    template <typename LockType>
+    void wait(LockType & lock)
+    {
+        park(lock, FastSteadyClock::time_point{});
+    }
+
+    template <typename LockType, typename Predicate>
+    void wait(LockType & lock, Predicate pred)
+    {
+        while (!pred())
+            wait(lock);
+    }
+
+    template <typename LockType, typename Rep, typename Period>
+    std::cv_status wait_for(LockType & lock, std::chrono::duration<Rep, Period> dur)
+    {
+        return wait_until(lock, FastSteadyClock::now() +
+                std::chrono::duration_cast<FastSteadyClock::duration>(dur));
+    }
+
+    template <typename LockType>
+    std::cv_status wait_until(LockType & lock, FastSteadyClock::time_point deadline)
+    {
+        return park(lock, deadline) ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+
+    void notify_one()
+    {
+        if (!hasWaiters_.load(std::memory_order_relaxed))
+            return ;
+
+        ParkingLot::UnparkOne(this, [this](ParkingLot::UnparkResult result){
+                if (!result.mayHaveMore)
+                    hasWaiters_.store(0, std::memory_order_relaxed);
+                });
+    }
+
+    void notify_all()
+    {
+        if (!hasWaiters_.load(std::memory_order_relaxed))
+            return ;
+
+        hasWaiters_.store(0, std::memory_order_relaxed);
+        ParkingLot::UnparkAll(this);
+    }
+
+private:
+    // 在桶锁内标记有等待者, 入队后才放开用户的锁, 不会丢失唤醒
+    template <typename LockType>
+    bool park(LockType & lock, FastSteadyClock::time_point deadline)
+    {
+        bool notified = ParkingLot::Park(this,
+                [this]{
+                    hasWaiters_.store(1, std::memory_order_relaxed);
+                    return true;
+                },
+                [&]{ lock.unlock(); },
+                deadline).wasUnparked;
+        lock.lock();
+        return notified;
+    }
+};
+
+typedef CoConditionVariable co_condition_variable;
+
+} //namespace co
@@ -10,12 +10,15 @@ namespace co
 
 /// 协程条件变量
 // 1.与std::condition_variable_any的区别在于析构时不能有正在等待的协程, 否则抛异常
+// 2.等待节点在等待者的栈上, 等待和唤醒的路径上没有内存分配, 也没有std::function.
+//   (只有不需要等待的节点, 即留在队列中缓冲的数据, 才会在堆上分配)
 
 template <typename T>
 class ConditionVariableAnyT
 {
 public:
-    typedef std::function<void(T &)> Functor;
+    // 等待者的数据转为缓冲数据后, 在队列锁内调用. 普通函数指针加上下文, 不用std::function
+    typedef void (*Functor)(T & value, void* context);
 
     enum class cv_status { no_timeout, timeout, no_queued };
 
@@ -23,11 +26,12 @@ private:
     // 兼容原生线程
     struct NativeThreadEntry
     {
-        std::mutex mtx;
+        // 唤醒者可能是协程, 持有期间不能被抢占; 等待的原生线程按std::mutex使用
+        RuntimeMutex mtx;
 
-        std::condition_variable_any cv;
+        std::condition_variable cv;
 
-        LFLock2 notified;
+        bool notified = false;
     };
 
     enum eSuspendFlag
@@ -35,13 +39,13 @@ private:
         suspend_begin = 0x1,
         suspend_end = 0x2,
         wakeup_begin = 0x4,
-        wakeup_end = 0x8,
+        wakeup_end = 0x8,   // 唤醒者不再访问这个节点
     };
 
-    struct Entry : public WaitQueueHook, public RefObject
+    struct Entry : public WaitQueueHook
     {
         // 控制是否超时的标志位
-        LFLock noTimeoutLock;
+        LFFlag noTimeoutLock;
 
         atomic_t<int> suspendFlags {0};
 
@@ -51,17 +55,25 @@ private:
 
         NativeThreadEntry* nativeThreadEntry;
 
+        // false: 不需要等待的节点, 在堆上分配, 出队的一方负责释放
         bool isWaiting;
 
         Entry() : value(), nativeThreadEntry(nullptr), isWaiting(true) {}
-        ~Entry() {
-            if (nativeThreadEntry) {
-                delete nativeThreadEntry;
-                nativeThreadEntry = nullptr;
-            }
+
+        void notifyDone() {
+            suspendFlags.fetch_or(eSuspendFlag::wakeup_end, std::memory_order_release);
         }
 
-        bool notify(Functor const func) {
+        // 等待者返回前, 确保唤醒者已不再访问这个节点
+        void waitNotifyDone() {
+            while ((suspendFlags.load(std::memory_order_acquire) & eSuspendFlag::wakeup_end) == 0);
+        }
+
+        // 节点已出队(或在队列锁内), 返回false表示等待者已超时
+        // @deferred: 非空时不在这里唤醒协程, 而是交给调用者在队列锁外唤醒
+        template <typename F>
+        bool notify(F const& func, bool handoff,
+                Processer::SuspendEntry* deferred = nullptr) {
             DebugPrint(dbg_channel, "cv::notify ->");
             for (;;) {
                 int flag = suspendFlags.load(std::memory_order_relaxed);
@@ -80,19 +92,13 @@ private:
                 {
                     DebugPrint(dbg_channel, "cv::notify -> wakeup complete");
 
-                    flag |= eSuspendFlag::wakeup_begin | eSuspendFlag::wakeup_end;
-
-                    if (!noTimeoutLock.try_lock()) {
-                        assert(false);
-                        suspendFlags.store(flag, std::memory_order_release);
-                        DebugPrint(dbg_channel, "cv::notify -> wakeup_end");
-                        return false;;
-                    }
+                    bool locked = noTimeoutLock.try_lock();
+                    (void)locked;
+                    assert(locked);
 
-                    if (func)
-                        func(value);
+                    func(value);
 
-                    suspendFlags.store(flag, std::memory_order_release);
+                    notifyDone();
                     DebugPrint(dbg_channel, "cv::notify -> wakeup_end");
                     return true;
                 }
@@ -102,33 +108,58 @@ private:
 
             // coroutine
             if (!nativeThreadEntry) {
-                if (!noTimeoutLock.try_lock())
-                    return false;;
-
-                if (Processer::Wakeup(coroEntry, [&]{ if (func) func(value); })) {
-//                    DebugPrint(dbg_channel, "notify %d.", value.id);
-                    return true;
+                if (!noTimeoutLock.try_lock()) {
+                    notifyDone();
+                    return false;
                 }
 
-                return false;;
+                // 先交付数据再唤醒; 即使协程已被定时器唤醒, 它也会等到notifyDone之后再返回
+                func(value);
+                Processer::SuspendEntry suspendEntry = coroEntry;
+                notifyDone();
+                if (deferred)
+                    *deferred = suspendEntry;
+                else
+                    Processer::Wakeup(suspendEntry, NULL, handoff);
+                return true;
             }
 
             // native thread
-            std::unique_lock<std::mutex> threadLock(nativeThreadEntry->mtx);
-            if (!noTimeoutLock.try_lock())
-                return false;;
+            std::unique_lock<RuntimeMutex> threadLock(nativeThreadEntry->mtx);
+            if (!noTimeoutLock.try_lock()) {
+                threadLock.unlock();
+                notifyDone();
+                return false;
+            }
 
-            if (func)
-                func(value);
+            func(value);
+            nativeThreadEntry->notified = true;
             nativeThreadEntry->cv.notify_one();
+            threadLock.unlock();
+            notifyDone();
             return true;
         }
     };
 
+    struct NoCond
+    {
+        typename WaitQueue<Entry>::CondRet operator()(size_t) const { return {true, true}; }
+    };
+
+    struct NoFunctor
+    {
+        void operator()(T &) const {}
+    };
+
     WaitQueue<Entry> queue_;
 
+    Functor convertToNonblockingFunctor_;
+    void* convertToNonblockingContext_;
+
     bool relockAfterWait_ = true;
 
+    bool handoff_ = false;
+
     template <typename LockType>
     struct AutoLock
     {
@@ -143,71 +174,138 @@ public:
     typedef typename WaitQueue<Entry>::CondRet CondRet;
 
 public:
+    // @nonblockingCapacity: 队列中前nonblockingCapacity-1个节点不需要等待,
+    //                       等待者前移到这个范围内时被唤醒, 数据留在队列中.
     explicit ConditionVariableAnyT(size_t nonblockingCapacity = 0,
-            Functor convertToNonblockingFunctor = NULL)
-        : queue_(&isValid, nonblockingCapacity,
-                [=](Entry *entry)
-                {
-                    if (entry->notify(convertToNonblockingFunctor)) {
-                        entry->isWaiting = false;
-                        return true;
-                    }
-                    return false;
-                })
+            Functor convertToNonblockingFunctor = nullptr,
+            void* convertToNonblockingContext = nullptr)
+        : queue_(nonblockingCapacity),
+        convertToNonblockingFunctor_(convertToNonblockingFunctor),
+        convertToNonblockingContext_(convertToNonblockingContext)
     {
     }
-    ~ConditionVariableAnyT() {}
+
+    ~ConditionVariableAnyT() {
+        Entry* entry = nullptr;
+        while (queue_.pop(entry)) {
+            assert(!entry->isWaiting);
+            if (!entry->isWaiting)
+                delete entry;
+        }
+    }
 
     void setRelockAfterWait(bool b) { relockAfterWait_ = b; }
 
+    // 唤醒同一个Processer上的协程时, 让它紧跟在当前协程之后执行(参见Processer::Wakeup)
+    void setHandoff(bool b) { handoff_ = b; }
+
     template <typename LockType>
-    cv_status wait(LockType & lock,
-            T value = T(),
-            std::function<CondRet(size_t)> const& cond = NULL)
+    cv_status wait(LockType & lock, T value = T())
+    {
+        return wait(lock, std::move(value), NoCond());
+    }
+
+    // @cond: CondRet(size_t queueSize), 在队列锁内调用, 决定是否入队、是否需要等待
+    template <typename LockType, typename Cond>
+    cv_status wait(LockType & lock, T value, Cond const& cond)
     {
         std::chrono::seconds* time = nullptr;
-        return do_wait(lock, time, value, cond);
+        return do_wait(lock, time, std::move(value), cond);
     }
 
     template <typename LockType, typename TimeDuration>
-    cv_status wait_for(LockType & lock,
-            TimeDuration duration,
-            T value = T(),
-            std::function<CondRet(size_t)> const& cond = NULL)
+    cv_status wait_for(LockType & lock, TimeDuration duration, T value = T())
     {
-        return do_wait(lock, &duration, value, cond);
+        return wait_for(lock, duration, std::move(value), NoCond());
+    }
+
+    template <typename LockType, typename TimeDuration, typename Cond>
+    cv_status wait_for(LockType & lock, TimeDuration duration, T value, Cond const& cond)
+    {
+        return do_wait(lock, &duration, std::move(value), cond);
     }
 
     template <typename LockType, typename TimePoint>
-    cv_status wait_util(LockType & lock,
-            TimePoint timepoint,
-            T value = T(),
-            std::function<CondRet(size_t)> const& cond = NULL)
+    cv_status wait_util(LockType & lock, TimePoint timepoint, T value = T())
     {
-        return do_wait(lock, &timepoint, value, cond);
+        return wait_util(lock, timepoint, std::move(value), NoCond());
     }
 
-    bool notify_one(Functor const& func = NULL)
+    template <typename LockType, typename TimePoint, typename Cond>
+    cv_status wait_util(LockType & lock, TimePoint timepoint, T value, Cond const& cond)
+    {
+        return do_wait(lock, &timepoint, std::move(value), cond);
+    }
+
+    bool notify_one()
+    {
+        return notify_one(NoFunctor());
+    }
+
+    // @func: void(T & value), 唤醒前在等待者的数据上调用
+    template <typename F>
+    bool notify_one(F const& func)
     {
         Entry* entry = nullptr;
-        while (queue_.pop(entry)) {
-            AutoRelease<Entry> pEntry(entry);
+        Processer::SuspendEntry converted;
+        auto onPos = [&](Entry* pos) { return convertToNonblocking(pos, converted); };
+        while (queue_.pop(entry, onPos)) {
+            // 前移到缓冲区内的等待者, 出了队列锁再唤醒
+            if (converted) {
+                Processer::Wakeup(converted, NULL, handoff_);
+                converted = Processer::SuspendEntry();
+            }
 
             if (!entry->isWaiting) {
-                if (func)
-                    func(entry->value);
+                func(entry->value);
+                delete entry;
                 return true;
             }
 
-            if (entry->notify(func))
+            if (entry->notify(func, handoff_))
                 return true;
         }
 
         return false;
     }
 
-    size_t notify_all(Functor const& func = NULL)
+    // 只唤醒value满足pred(T const&)的等待者
+    template <typename Pred, typename F>
+    bool notify_one_if(Pred const& pred, F const& func)
     {
+        Entry* entry = nullptr;
+        auto match = [&](Entry* e) { return pred(const_cast<T const&>(e->value)); };
+        while (queue_.popIf(entry, match)) {
+            if (!entry->isWaiting) {
+                func(entry->value);
+                delete entry;
+                return true;
+            }
+
+            if (entry->notify(func, handoff_))
+                return true;
+        }
+
+        return false;
+    }
+
+    // 是否有value满足pred(T const&)的等待者
+    template <typename Pred>
+    bool any_of(Pred const& pred)
+    {
+        return queue_.anyOf([&](Entry* e) { return pred(const_cast<T const&>(e->value)); });
+    }
+
+    size_t notify_all()
+    {
+        return notify_all(NoFunctor());
+    }
+
+    template <typename F>
+    size_t notify_all(F const& func)
+    {
+        // 被唤醒的协程按Processer分组, 每个Processer只加一次锁
+        WakeupBatch batch;
         size_t n = 0;
         while (notify_one(func))
             ++n;
@@ -223,6 +321,23 @@ public:
     }
 
 private:
+    // 在队列锁内调用: 把等待者的数据移到堆上留在队列中.
+    // 协程等待者由调用者在队列锁外通过wakeup唤醒; 原生线程的节点在它返回后就失效了, 只能在锁内通知.
+    Entry* convertToNonblocking(Entry* pos, Processer::SuspendEntry & wakeup)
+    {
+        if (!pos->isWaiting) return pos;
+
+        Entry* buf = nullptr;
+        auto move = [&](T & value) {
+            buf = new Entry;
+            buf->value = std::move(value);
+            buf->isWaiting = false;
+            if (convertToNonblockingFunctor_)
+                convertToNonblockingFunctor_(buf->value, convertToNonblockingContext_);
+        };
+        return pos->notify(move, handoff_, &wakeup) ? buf : nullptr;
+    }
+
     template <typename TimeType>
     inline void coroSuspend(Processer::SuspendEntry & coroEntry, TimeType * time)
     {
@@ -232,53 +347,48 @@ private:
             coroEntry = Processer::Suspend();
     }
 
-    template <typename LockType, typename Rep, typename Period>
-    inline void threadSuspend(std::condition_variable_any & cv,
-            LockType & lock, std::chrono::duration<Rep, Period> * dur)
+    template <typename Rep, typename Period>
+    inline void threadSuspend(NativeThreadEntry & nte,
+            std::unique_lock<std::mutex> & lock, std::chrono::duration<Rep, Period> * dur)
     {
         if (dur)
-            cv.wait_for(lock, *dur);
+            nte.cv.wait_for(lock, *dur, [&]{ return nte.notified; });
         else
-            cv.wait(lock);
+            nte.cv.wait(lock, [&]{ return nte.notified; });
     }
 
-    template <typename LockType, typename Clock, typename Duration>
-    inline void threadSuspend(std::condition_variable_any & cv,
-            LockType & lock, std::chrono::time_point<Clock, Duration> * tp)
+    template <typename Clock, typename Duration>
+    inline void threadSuspend(NativeThreadEntry & nte,
+            std::unique_lock<std::mutex> & lock, std::chrono::time_point<Clock, Duration> * tp)
     {
         if (tp)
-            cv.wait_until(lock, *tp);
+            nte.cv.wait_until(lock, *tp, [&]{ return nte.notified; });
         else
-            cv.wait(lock);
+            nte.cv.wait(lock, [&]{ return nte.notified; });
     }
 
-    template <typename LockType, typename TimeType>
+    template <typename LockType, typename TimeType, typename Cond>
     cv_status do_wait(LockType & lock,
-            TimeType* time, T value = T(),
-            std::function<CondRet(size_t)> const& cond = NULL)
+            TimeType* time, T value, Cond const& cond)
     {
         cv_status result;
-        Entry *entry = new Entry;
-        AutoRelease<Entry> pEntry(entry);
-        entry->value = value;
-        size_t qSize = 0;
-        auto ret = queue_.push(entry, [&](size_t queueSize){
-                CondRet ret{true, true};
-                if (cond) {
-                    ret = cond(queueSize);
-                    if (!ret.canQueue)
-                        return ret;
-                }
-
-                entry->IncrementRef();
+        Entry entry;
+        entry.value = std::move(value);
+        CondRet ret{true, true};
+        queue_.push([&](size_t queueSize) -> Entry* {
+                ret = cond(queueSize);
+                if (!ret.canQueue)
+                    return nullptr;
 
                 if (!ret.needWait) {
-                    entry->isWaiting = false;
-                    return ret;
+                    // 不需要等待, 数据留在队列中由对端取走
+                    Entry* buf = new Entry;
+                    buf->value = std::move(entry.value);
+                    buf->isWaiting = false;
+                    return buf;
                 }
 
-                qSize = queueSize;
-                return ret;
+                return &entry;
                 });
 
         if (!ret.canQueue) {
@@ -299,12 +409,12 @@ private:
         int spinB = 0;
         int flag = 0;
         for (;;) {
-            flag = entry->suspendFlags.load(std::memory_order_relaxed);
+            flag = entry.suspendFlags.load(std::memory_order_relaxed);
 
             if (flag & eSuspendFlag::wakeup_begin) {
                 DebugPrint(dbg_channel, "cv::wait -> flag = wakeup_begin");
                 // 已在被唤醒
-                while ((entry->suspendFlags.load(std::memory_order_acquire) & eSuspendFlag::wakeup_end) == 0);
+                entry.waitNotifyDone();
                 return cv_status::no_timeout;
             } else {
                 // 无人唤醒, 先自旋等一等再真正挂起
@@ -313,8 +423,8 @@ private:
                 }
 
                 if (Processer::IsCoroutine()) {
-//                    if (++spinB <= 1 << (4 - (std::min)((size_t)4, qSize))) {
-                    if (++spinB <= 1) {
+                    // handoff时对端会直接切换过来, 不必先让出一次
+                    if (!handoff_ && ++spinB <= 1) {
                         Processer::StaticCoYield();
                         continue;
                     }
@@ -326,7 +436,7 @@ private:
                 }
             }
 
-            if (entry->suspendFlags.compare_exchange_weak(flag,
+            if (entry.suspendFlags.compare_exchange_weak(flag,
                         flag | eSuspendFlag::suspend_begin,
                         std::memory_order_acq_rel, std::memory_order_relaxed))
                 break;
@@ -337,37 +447,45 @@ private:
         DebugPrint(dbg_channel, "cv::wait -> suspend_begin");
         if (Processer::IsCoroutine()) {
             // 协程
-            coroSuspend(entry->coroEntry, time);
-            entry->suspendFlags.store(flag, std::memory_order_release);   // release
+            coroSuspend(entry.coroEntry, time);
+            entry.suspendFlags.store(flag, std::memory_order_release);   // release
             DebugPrint(dbg_channel, "cv::wait -> suspend_end");
             Processer::StaticCoYield();
-            result = entry->noTimeoutLock.try_lock() ?
+            result = entry.noTimeoutLock.try_lock() ?
                 cv_status::timeout :
                 cv_status::no_timeout;
         } else {
             // 原生线程
-            entry->nativeThreadEntry = new NativeThreadEntry;
-            std::unique_lock<std::mutex> threadLock(entry->nativeThreadEntry->mtx);
-            entry->suspendFlags.store(flag, std::memory_order_release);   // release
+            NativeThreadEntry nte;
+            entry.nativeThreadEntry = &nte;
+            std::unique_lock<std::mutex> threadLock(nte.mtx);
+            entry.suspendFlags.store(flag, std::memory_order_release);   // release
             DebugPrint(dbg_channel, "cv::wait -> suspend_end");
-            threadSuspend(entry->nativeThreadEntry->cv, threadLock, time);
-            result = entry->noTimeoutLock.try_lock() ?
+            threadSuspend(nte, threadLock, time);
+            result = entry.noTimeoutLock.try_lock() ?
                 cv_status::timeout :
                 cv_status::no_timeout;
+            threadLock.unlock();
+
+            // nte析构前, 唤醒者必须已经放手
+            finishWait(entry, result);
+            return result;
         }
-        //如果超时，那么发送notify清除queue中的entry
-        if (result == cv_status::timeout) {
-            notify_one();
-        }
+
+        finishWait(entry, result);
         return result;
     }
 
-    static bool isValid(Entry* entry) {
-        if (!entry->isWaiting) return true;
-        if ((entry->suspendFlags & eSuspendFlag::suspend_begin) == 0) return true;
-        if (!entry->nativeThreadEntry)
-            return !entry->coroEntry.IsExpire();
-        return entry->nativeThreadEntry->notified.is_lock();
+    // 超时: 把自己从队列中摘掉; 如果已经被唤醒者取走, 等它放手.
+    // 唤醒者抢到了noTimeoutLock的话, 就一定会交付数据.
+    void finishWait(Entry & entry, cv_status result)
+    {
+        if (result == cv_status::timeout) {
+            if (!queue_.erase(&entry))
+                entry.waitNotifyDone();
+        } else {
+            entry.waitNotifyDone();
+        }
     }
 };
 
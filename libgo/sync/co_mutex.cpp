@@ -1,54 +1,166 @@
 #include "co_mutex.h"
 #include "../scheduler/scheduler.h"
+#include <thread>
 
 namespace co
 {
 
+// 抢锁失败后最多自旋的次数
+static const int kSpinLimit = 64;
+
+// 等待者等待超过这个时间, 锁进入饥饿模式
+static const FastSteadyClock::duration kStarvationThreshold = std::chrono::milliseconds(1);
+
 CoMutex::CoMutex()
 {
-    sem_ = 1;
 }
 
 CoMutex::~CoMutex()
 {
-//    assert(lock_.try_lock());
+//    assert(state_ == 0);
 }
 
 void CoMutex::lock()
 {
-    if (--sem_ == 0)
+    uint8_t expected = 0;
+    if (state_.compare_exchange_weak(expected, eState::locked,
+                std::memory_order_acquire, std::memory_order_relaxed))
         return ;
 
-    std::unique_lock<lock_t> lock(lock_);
-    if (notified_) {
-        notified_ = false;
-        return ;
+    lockSlow();
+}
+
+// 自旋的条件(参考Go的runtime_canSpin): 次数有限, 多核, 当前调度线程上没有其他可运行的协程.
+// 单核时持有者不可能同时在运行; 有其他协程可运行时, 挂起让出CPU比空转更划算.
+bool CoMutex::canSpin(int iteration)
+{
+    if (iteration >= kSpinLimit)
+        return false;
+
+    static const bool multicore = std::thread::hardware_concurrency() > 1;
+    if (!multicore)
+        return false;
+
+    return !Processer::HasOtherRunnable();
+}
+
+void CoMutex::lockSlow()
+{
+    int spin = 0;
+    FastSteadyClock::time_point waitStart{};
+    for (;;) {
+        uint8_t state = state_.load(std::memory_order_relaxed);
+
+        // 饥饿模式下锁只在等待者之间交接, 新来者不抢锁
+        if (!(state & (eState::locked | eState::starving))) {
+            if (state_.compare_exchange_weak(state, state | eState::locked,
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                return ;
+            continue;
+        }
+
+        // 还没有人排队时自旋等待持有者释放
+        if (!(state & (eState::parked | eState::starving)) && canSpin(spin++)) {
+            CpuRelax();
+            continue;
+        }
+
+        if (!(state & eState::parked)) {
+            if (!state_.compare_exchange_weak(state, state | eState::parked,
+                        std::memory_order_relaxed, std::memory_order_relaxed))
+                continue;
+        }
+
+        if (waitStart == FastSteadyClock::time_point{}) {
+            waitStart = FastSteadyClock::now();
+        } else if (!(state & eState::starving) &&
+                FastSteadyClock::now() - waitStart > kStarvationThreshold) {
+            // 被唤醒后又没抢到锁, 并且已经等待了太久, 进入饥饿模式
+            state_.compare_exchange_weak(state, state | eState::starving,
+                        std::memory_order_relaxed, std::memory_order_relaxed);
+            continue;
+        }
+
+        ParkingLot::ParkResult result = ParkingLot::Park(&state_, [this]{
+                uint8_t state = state_.load(std::memory_order_relaxed);
+                return (state & eState::locked) && (state & eState::parked);
+                });
+        if (result.token == kHandoffToken) {
+            // 锁已经直接交给了我. 等待时间很短说明已经不饥饿了, 退出饥饿模式
+            if (FastSteadyClock::now() - waitStart < kStarvationThreshold)
+                state_.fetch_and(~eState::starving, std::memory_order_relaxed);
+            return ;
+        }
     }
-    cv_.wait(lock);
 }
 
 bool CoMutex::try_lock()
 {
-    if (--sem_ == 0)
-        return true;
-
-    ++sem_;
+    uint8_t state = state_.load(std::memory_order_relaxed);
+    while (!(state & eState::locked)) {
+        if (state_.compare_exchange_weak(state, state | eState::locked,
+                    std::memory_order_acquire, std::memory_order_relaxed))
+            return true;
+    }
     return false;
 }
 
 bool CoMutex::is_lock()
 {
-    return sem_ < 1;
+    return state_.load(std::memory_order_relaxed) & eState::locked;
 }
 
 void CoMutex::unlock()
 {
-    if (++sem_ == 1)
+    uint8_t expected = eState::locked;
+    if (state_.compare_exchange_weak(expected, 0,
+                std::memory_order_release, std::memory_order_relaxed))
         return ;
 
-    std::unique_lock<lock_t> lock(lock_);
-    if (!cv_.notify_one())
-        notified_ = true;
+    unlockSlow();
+}
+
+void CoMutex::unlockSlow()
+{
+    for (;;) {
+        uint8_t state = state_.load(std::memory_order_relaxed);
+        assert(state & eState::locked);
+        if (state == eState::locked) {
+            if (state_.compare_exchange_weak(state, 0,
+                        std::memory_order_release, std::memory_order_relaxed))
+                return ;
+            continue;
+        }
+
+        // 有等待者: 在桶锁内放锁(或交接)并更新parked位, 等待者重新验证时能看到最新状态
+        // 桶锁挡不住不排队的抢锁者, 它们可能同时设置starving位, 只能用CAS修改要变的位
+        ParkingLot::UnparkOne(&state_, [this](ParkingLot::UnparkResult & result){
+                uint8_t state = state_.load(std::memory_order_relaxed);
+                for (;;) {
+                    uint8_t newState;
+                    bool handoff = result.didUnpark && (state & eState::starving);
+                    if (handoff) {
+                        // 饥饿模式: 保持locked位, 锁直接交给被唤醒者. 没有其他等待者时退出饥饿模式
+                        newState = result.mayHaveMore ? state : (uint8_t)eState::locked;
+                    } else {
+                        // 队列排空时同时退出饥饿模式, 否则新来者既不抢锁又挂不起来
+                        newState = state & ~(eState::locked | eState::parked);
+                        if (result.mayHaveMore)
+                            newState |= eState::parked;
+                        else
+                            newState &= ~eState::starving;
+                    }
+
+                    if (state_.compare_exchange_weak(state, newState,
+                                std::memory_order_release, std::memory_order_relaxed)) {
+                        if (handoff)
+                            result.token = kHandoffToken;
+                        return ;
+                    }
+                }
+                });
+        return ;
+    }
 }
 
 } //namespace co
@@ -1,21 +1,30 @@
 #pragma once
 #include "../common/config.h"
 #include "../scheduler/processer.h"
-#include <queue>
-#include "co_condition_variable.h"
+#include "parking_lot.h"
 
 namespace co
 {
 
 /// 协程锁
+// 只有一个字节的状态, 有竞争时在ParkingLot中以状态的地址挂起.
+// 1.持有者通常正在其他核心上运行并且很快释放, 所以抢锁失败后先有限次自旋, 再挂起.
+// 2.正常模式: 解锁时不直接把锁交给等待者, 被唤醒的等待者和新来者一起抢锁(吞吐量高).
+// 3.饥饿模式: 有等待者等待超过kStarvationThreshold后进入, 解锁时把锁直接交给队首的等待者,
+//   新来者不自旋也不抢锁, 直接排队(与Go的sync.Mutex相同). 队列排空或交接的等待者等待时间很短时退出.
 class CoMutex
 {
-    typedef std::mutex lock_t;
-    lock_t lock_;
-    bool notified_ = false;
-    ConditionVariableAny cv_;
+    enum eState : uint8_t
+    {
+        locked = 0x1,
+        parked = 0x2,   // 可能有等待者
+        starving = 0x4, // 饥饿模式
+    };
 
-    std::atomic_long sem_;
+    // 解锁者通过ParkingLot的token告诉被唤醒者: 锁已经交给你了
+    static const intptr_t kHandoffToken = 1;
+
+    atomic_t<uint8_t> state_{0};
 
 public:
     CoMutex();
@@ -25,6 +34,11 @@ public:
     bool try_lock();
     bool is_lock();
     void unlock();
+
+private:
+    bool canSpin(int iteration);
+    void lockSlow();
+    void unlockSlow();
 };
 
 typedef CoMutex co_mutex;
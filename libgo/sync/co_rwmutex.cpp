@@ -1,159 +1,345 @@
 #include "co_rwmutex.h"
 #include "../scheduler/scheduler.h"
+#include <thread>
 
 namespace co
 {
 
-CoRWMutex::CoRWMutex(bool writePriority)
+// 可见读者表的槽数, 2的幂
+static const std::size_t kVisibleReaders = 1024;
+
+// 撤销偏向后, 在撤销耗时的这个倍数的时间内不恢复偏向
+static const int kBiasInhibitMultiplier = 9;
+
+// 可见读者表的一个槽: 读偏向模式下持有读锁的读者在这里登记
+struct alignas(64) VisibleReaderSlot
+{
+    atomic_t<const void*> lock{nullptr};
+    atomic_t<const void*> owner{nullptr};
+};
+
+static VisibleReaderSlot s_visibleReaders[kVisibleReaders];
+
+// 禁止恢复偏向的截止时间, 以锁的地址哈希(冲突只影响恢复偏向的时机, 不影响正确性)
+static atomic_t<int64_t> s_inhibitUntil[kVisibleReaders];
+
+static std::size_t HashAddr(std::size_t h)
+{
+    h ^= h >> 17;
+    h *= (std::size_t)0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    return h & (kVisibleReaders - 1);
+}
+
+// 读者的标识: 协程中是当前协程(迁移到其他线程也不变), 否则是当前线程
+static const void* CurrentReader()
+{
+    Task* tk = Processer::GetCurrentTask();
+    if (tk) return tk;
+
+    static thread_local char tls;
+    return &tls;
+}
+
+static VisibleReaderSlot & GetReaderSlot(const void* lock, const void* reader)
+{
+    return s_visibleReaders[HashAddr((uintptr_t)lock * 31 + (uintptr_t)reader)];
+}
+
+static atomic_t<int64_t> & InhibitUntil(const void* lock)
+{
+    return s_inhibitUntil[HashAddr((uintptr_t)lock)];
+}
+
+CoRWMutex::CoRWMutex(bool writePriority, bool readerBias)
+    : state_((writePriority ? eState::write_priority : 0) |
+            (readerBias ? eState::reader_bias | eState::read_biased : 0))
 {
-    lockState_ = 0;
-    writePriority_ = writePriority;
-    readView_.self_ = writeView_.self_ = this;
 }
 CoRWMutex::~CoRWMutex()
 {
-    assert(lock_.try_lock());
-    assert(lockState_ == 0);
-    readView_.self_ = writeView_.self_ = nullptr;
+    assert((state_ & ~(uint32_t)(eState::write_priority | eState::reader_bias | eState::read_biased)) == 0);
+}
+
+bool CoRWMutex::readBlocked(uint32_t state)
+{
+    if (state & eState::write_locked)
+        return true;
+
+    // 写优先: 有写者在等待时, 新的读者也要等待
+    return (state & eState::write_priority) && (state & eState::writers_parked);
 }
 
 void CoRWMutex::RLock()
 {
-    std::unique_lock<LFLock> lock(lock_);
+    if (rTryLockBiased())
+        return ;
 
-retry:
-    if (writePriority_) {
-        // 写优先
-        if (lockState_ >= 0 && wCv_.empty()) {
-            ++lockState_;
-            return ;
+    for (;;) {
+        uint32_t state = state_.load(std::memory_order_relaxed);
+        if (!readBlocked(state)) {
+            if (state_.compare_exchange_weak(state, state + eState::reader_one,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                tryBias();
+                return ;
+            }
+            continue;
         }
-    } else {
-        // 读优先
-        if (lockState_ >= 0) {
-            ++lockState_;
-            return ;
+
+        if (!(state & eState::readers_parked)) {
+            if (!state_.compare_exchange_weak(state, state | eState::readers_parked,
+                        std::memory_order_relaxed, std::memory_order_relaxed))
+                continue;
         }
-    }
 
-    rCv_.wait(lock);
-    goto retry;
+        ParkingLot::Park(readerKey(), [this]{
+                uint32_t state = state_.load(std::memory_order_relaxed);
+                return (state & eState::readers_parked) && readBlocked(state);
+                });
+    }
 }
 bool CoRWMutex::RTryLock()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    if (lockState_ >= 0) {
-        ++lockState_;
+    if (rTryLockBiased())
         return true;
+
+    uint32_t state = state_.load(std::memory_order_relaxed);
+    while (!(state & eState::write_locked)) {
+        if (state_.compare_exchange_weak(state, state + eState::reader_one,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+            tryBias();
+            return true;
+        }
     }
     return false;
 }
 void CoRWMutex::RUnlock()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    assert(lockState_ > 0);
-    if (--lockState_ > 0)
+    if (rUnlockBiased())
         return ;
 
-    TryWakeUp();
+    uint32_t state = state_.fetch_sub(eState::reader_one, std::memory_order_release);
+    assert(state >= eState::reader_one);
+    if (state >= 2 * eState::reader_one)
+        return ;
+
+    if (state & (eState::writers_parked | eState::readers_parked))
+        TryWakeUp();
 }
 
 void CoRWMutex::WLock()
 {
-    std::unique_lock<LFLock> lock(lock_);
+    for (;;) {
+        uint32_t state = state_.load(std::memory_order_relaxed);
+        if (!(state & eState::write_locked) && state < eState::reader_one) {
+            // 加写锁的同时撤销偏向
+            if (state_.compare_exchange_weak(state,
+                        (state | eState::write_locked) & ~(uint32_t)eState::read_biased,
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                if (state & eState::read_biased)
+                    revokeBias(true);
+                return ;
+            }
+            continue;
+        }
 
-retry:
-    if (lockState_ == 0) {
-        lockState_ = -1;
-        return ;
-    }
+        if (!(state & eState::writers_parked)) {
+            if (!state_.compare_exchange_weak(state, state | eState::writers_parked,
+                        std::memory_order_relaxed, std::memory_order_relaxed))
+                continue;
+        }
 
-    wCv_.wait(lock);
-    goto retry;
+        ParkingLot::Park(writerKey(), [this]{
+                uint32_t state = state_.load(std::memory_order_relaxed);
+                return (state & eState::writers_parked) &&
+                    ((state & eState::write_locked) || state >= eState::reader_one);
+                });
+    }
 }
 bool CoRWMutex::WTryLock()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    if (lockState_ == 0) {
-        lockState_ = -1;
-        return true;
+    uint32_t state = state_.load(std::memory_order_relaxed);
+    while (!(state & eState::write_locked) && state < eState::reader_one) {
+        if (state_.compare_exchange_weak(state,
+                    (state | eState::write_locked) & ~(uint32_t)eState::read_biased,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+            return (state & eState::read_biased) ? revokeBias(false) : true;
     }
     return false;
 }
 void CoRWMutex::WUnlock()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    assert(lockState_ == -1);
+    uint32_t state = state_.fetch_and(~(uint32_t)eState::write_locked, std::memory_order_release);
+    assert(state & eState::write_locked);
+    if (state & (eState::writers_parked | eState::readers_parked))
+        TryWakeUp();
+}
+
+bool CoRWMutex::rTryLockBiased()
+{
+    if (!(state_.load(std::memory_order_relaxed) & eState::read_biased))
+        return false;
+
+    const void* reader = CurrentReader();
+    VisibleReaderSlot & slot = GetReaderSlot(this, reader);
+    const void* expected = nullptr;
+    if (!slot.lock.compare_exchange_strong(expected, this,
+                std::memory_order_seq_cst, std::memory_order_relaxed))
+        return false;
+    slot.owner.store(reader, std::memory_order_relaxed);
 
-    lockState_ = 0;
-    TryWakeUp();
+    // 读者先登记再检查偏向, 写者先撤销偏向再扫描, 两者至少有一方能看到对方
+    if (state_.load(std::memory_order_seq_cst) & eState::read_biased)
+        return true;
+
+    slot.owner.store(nullptr, std::memory_order_relaxed);
+    slot.lock.store(nullptr, std::memory_order_release);
+    return false;
+}
+
+bool CoRWMutex::rUnlockBiased()
+{
+    if (!(state_.load(std::memory_order_relaxed) & eState::reader_bias))
+        return false;
+
+    // 同一个读者的多个读锁可能共用一个槽, 它们总是成对释放, 谁先释放槽都不影响计数
+    const void* reader = CurrentReader();
+    VisibleReaderSlot & slot = GetReaderSlot(this, reader);
+    if (slot.lock.load(std::memory_order_relaxed) != this ||
+            slot.owner.load(std::memory_order_relaxed) != reader)
+        return false;
+
+    slot.owner.store(nullptr, std::memory_order_relaxed);
+    slot.lock.store(nullptr, std::memory_order_release);
+    return true;
+}
+
+// 普通读锁加锁成功后调用, 过了禁止期就恢复偏向
+void CoRWMutex::tryBias()
+{
+    uint32_t state = state_.load(std::memory_order_relaxed);
+    if ((state & (eState::reader_bias | eState::read_biased)) != eState::reader_bias)
+        return ;
+
+    if (FastSteadyClock::now().time_since_epoch().count() <
+            InhibitUntil(this).load(std::memory_order_relaxed))
+        return ;
+
+    // 持有读锁时不会有写者, 可以直接设置
+    state_.fetch_or(eState::read_biased, std::memory_order_relaxed);
+}
+
+// 已经持有写锁并撤销了偏向, 等待偏向期间进入的读者全部退出.
+// @wait: 为false时不等待, 还有读者时恢复偏向、放开写锁并返回false
+bool CoRWMutex::revokeBias(bool wait)
+{
+    FastSteadyClock::time_point start = FastSteadyClock::now();
+    for (std::size_t i = 0; i < kVisibleReaders; ++i) {
+        while (s_visibleReaders[i].lock.load(std::memory_order_seq_cst) == this) {
+            if (!wait) {
+                uint32_t state = state_.fetch_add(
+                        (uint32_t)eState::read_biased - eState::write_locked,
+                        std::memory_order_release);
+                if (state & (eState::writers_parked | eState::readers_parked))
+                    TryWakeUp();
+                return false;
+            }
+
+            if (Processer::IsCoroutine())
+                Processer::StaticCoYield();
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    FastSteadyClock::time_point now = FastSteadyClock::now();
+    InhibitUntil(this).store((now + (now - start) * kBiasInhibitMultiplier).time_since_epoch().count(),
+            std::memory_order_relaxed);
+    return true;
 }
 
 void CoRWMutex::TryWakeUp()
 {
     // 优先唤醒写等待
-    if (wCv_.notify_one())
-        return ;
+    if (state_.load(std::memory_order_relaxed) & eState::writers_parked) {
+        ParkingLot::UnparkResult result = ParkingLot::UnparkOne(writerKey(),
+                [this](ParkingLot::UnparkResult result){
+                    if (!result.mayHaveMore)
+                        state_.fetch_and(~(uint32_t)eState::writers_parked, std::memory_order_relaxed);
+                });
+        if (result.didUnpark)
+            return ;
+    }
 
     // 唤醒读等待
-    rCv_.notify_all();
+    if (state_.load(std::memory_order_relaxed) & eState::readers_parked) {
+        state_.fetch_and(~(uint32_t)eState::readers_parked, std::memory_order_relaxed);
+        ParkingLot::UnparkAll(readerKey());
+    }
 }
 
 bool CoRWMutex::IsLock()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    return lockState_ == -1;
+    return state_.load(std::memory_order_relaxed) & eState::write_locked;
 }
 
 CoRWMutex::ReadView & CoRWMutex::Reader()
 {
-    return readView_;
+    return *this;
 }
 CoRWMutex::WriteView & CoRWMutex::Writer()
 {
-    return writeView_;
+    return *this;
 }
 CoRWMutex::ReadView & CoRWMutex::reader()
 {
-    return readView_;
+    return *this;
 }
 CoRWMutex::WriteView & CoRWMutex::writer()
 {
-    return writeView_;
+    return *this;
 }
 
-void CoRWMutex::ReadView::lock()
+CoRWMutex* CoRWMutexReadView::self()
 {
-    self_->RLock();
+    return static_cast<CoRWMutex*>(this);
 }
-bool CoRWMutex::ReadView::try_lock()
+void CoRWMutexReadView::lock()
 {
-    return self_->RTryLock();
+    self()->RLock();
 }
-bool CoRWMutex::ReadView::is_lock()
+bool CoRWMutexReadView::try_lock()
 {
-    return self_->IsLock();
+    return self()->RTryLock();
 }
-void CoRWMutex::ReadView::unlock()
+bool CoRWMutexReadView::is_lock()
 {
-    return self_->RUnlock();
+    return self()->IsLock();
+}
+void CoRWMutexReadView::unlock()
+{
+    return self()->RUnlock();
 }
 
-void CoRWMutex::WriteView::lock()
+CoRWMutex* CoRWMutexWriteView::self()
+{
+    return static_cast<CoRWMutex*>(this);
+}
+void CoRWMutexWriteView::lock()
 {
-    self_->WLock();
+    self()->WLock();
 }
-bool CoRWMutex::WriteView::try_lock()
+bool CoRWMutexWriteView::try_lock()
 {
-    return self_->WTryLock();
+    return self()->WTryLock();
 }
-bool CoRWMutex::WriteView::is_lock()
+bool CoRWMutexWriteView::is_lock()
 {
-    return self_->IsLock();
+    return self()->IsLock();
 }
-void CoRWMutex::WriteView::unlock()
+void CoRWMutexWriteView::unlock()
 {
-    self_->WUnlock();
+    self()->WUnlock();
 }
 
 } //namespace co
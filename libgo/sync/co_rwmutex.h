@@ -1,27 +1,79 @@
 #pragma once
 #include "../common/config.h"
 #include "../scheduler/processer.h"
-#include <queue>
-#include "co_condition_variable.h"
+#include "parking_lot.h"
 
 namespace co
 {
 
+class CoRWMutex;
+
+// 读写锁的读/写视图, 作为CoRWMutex的空基类, 不占用空间
+class CoRWMutexReadView
+{
+    friend class CoRWMutex;
+    CoRWMutex* self();
+
+public:
+    void lock();
+    bool try_lock();
+    bool is_lock();
+    void unlock();
+
+    CoRWMutexReadView() = default;
+    CoRWMutexReadView(CoRWMutexReadView const&) = delete;
+    CoRWMutexReadView& operator=(CoRWMutexReadView const&) = delete;
+};
+
+class CoRWMutexWriteView
+{
+    friend class CoRWMutex;
+    CoRWMutex* self();
+
+public:
+    void lock();
+    bool try_lock();
+    bool is_lock();
+    void unlock();
+
+    CoRWMutexWriteView() = default;
+    CoRWMutexWriteView(CoRWMutexWriteView const&) = delete;
+    CoRWMutexWriteView& operator=(CoRWMutexWriteView const&) = delete;
+};
+
 /// 读写锁
-class CoRWMutex
+// 只有一个字的状态, 有竞争时在ParkingLot中挂起:
+// 写者以状态字的地址挂起, 读者以状态字地址+1挂起(只作为key, 不会访问).
+//
+// 读偏向模式(readerBias, 参考BRAVO), 用于读多写极少的场景:
+// 1.偏向时读者只在全局的可见读者表中占一个槽(以锁和读者哈希), 不写共享的状态字, 读者之间没有缓存行争用.
+//   槽被占用(哈希冲突)或偏向已撤销时, 退回普通的读锁.
+// 2.写者加写锁时撤销偏向, 等待表中属于这把锁的槽全部释放.
+//   撤销之后的一段时间(撤销耗时的kBiasInhibitMultiplier倍)内不恢复偏向, 限制频繁写时撤销的开销.
+// 3.偏向时写者到来就立即阻止新的读者, 相当于总是写优先.
+class CoRWMutex : private CoRWMutexReadView, private CoRWMutexWriteView
 {
-    LFLock lock_;
-    long lockState_;  // 0:无锁, >=1:读锁, -1:写锁
+    friend class CoRWMutexReadView;
+    friend class CoRWMutexWriteView;
 
-    // 兼容原生线程
-    ConditionVariableAny rCv_;
-    ConditionVariableAny wCv_;
+    enum eState : uint32_t
+    {
+        write_locked = 0x1,
+        writers_parked = 0x2,
+        readers_parked = 0x4,
+        write_priority = 0x8,   // 是否写优先, 构造后不变
+        reader_bias = 0x10,     // 是否启用读偏向模式, 构造后不变
+        read_biased = 0x20,     // 当前是否偏向读者
+        reader_one = 0x40,      // 高位是持有读锁的个数
+    };
 
-    // 是否写优先
-    bool writePriority_;
+    atomic_t<uint32_t> state_;
 
 public:
-    explicit CoRWMutex(bool writePriority = true);
+    typedef CoRWMutexReadView ReadView;
+    typedef CoRWMutexWriteView WriteView;
+
+    explicit CoRWMutex(bool writePriority = true, bool readerBias = false);
     ~CoRWMutex();
 
     void RLock();
@@ -34,42 +86,6 @@ public:
 
     bool IsLock();
 
-private:
-    void TryWakeUp();
-
-public:
-    class ReadView
-    {
-        friend class CoRWMutex;
-        CoRWMutex * self_;
-
-    public:
-        void lock();
-        bool try_lock();
-        bool is_lock();
-        void unlock();
-
-        ReadView() = default;
-        ReadView(ReadView const&) = delete;
-        ReadView& operator=(ReadView const&) = delete;
-    };
-
-    class WriteView
-    {
-        friend class CoRWMutex;
-        CoRWMutex * self_;
-
-    public:
-        void lock();
-        bool try_lock();
-        bool is_lock();
-        void unlock();
-
-        WriteView() = default;
-        WriteView(WriteView const&) = delete;
-        WriteView& operator=(WriteView const&) = delete;
-    };
-
     ReadView& Reader();
     WriteView& Writer();
 
@@ -78,8 +94,15 @@ public:
     WriteView& writer();
 
 private:
-    ReadView readView_;
-    WriteView writeView_;
+    bool readBlocked(uint32_t state);
+    bool rTryLockBiased();
+    bool rUnlockBiased();
+    void tryBias();
+    bool revokeBias(bool wait);
+    void TryWakeUp();
+
+    const void* writerKey() { return &state_; }
+    const void* readerKey() { return (const char*)&state_ + 1; }
 };
 
 typedef CoRWMutex co_rwmutex;
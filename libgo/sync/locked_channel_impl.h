@@ -2,7 +2,6 @@
 #include "../common/config.h"
 #include "channel_impl.h"
 #include "ringbuffer.h"
-#include <list>
 
 namespace co
 {
@@ -10,7 +9,7 @@ namespace co
 template <typename T>
 class LockedChannelImpl : public ChannelImpl<T>
 {
-    typedef std::mutex lock_t;
+    typedef RuntimeMutex lock_t;
     typedef FastSteadyClock::time_point time_point_t;
 
     lock_t lock_;
@@ -18,51 +17,72 @@ class LockedChannelImpl : public ChannelImpl<T>
     bool closed_;
     uint64_t dbg_mask_;
 
-    bool useRingBuffer_;
     RingBuffer<T> q_;
-    std::list<T> lq_;
 
     typedef ConditionVariableAnyT<T*> wait_queue_t;
     wait_queue_t wq_;
     wait_queue_t rq_;
 
 public:
-    explicit LockedChannelImpl(std::size_t capacity, bool useRingBuffer)
+    explicit LockedChannelImpl(std::size_t capacity)
         : capacity_(capacity), closed_(false), dbg_mask_(dbg_all)
-        , useRingBuffer_(useRingBuffer)
-        , q_(useRingBuffer ? capacity : 1)
+        , q_(capacity)
     {
         wq_.setRelockAfterWait(false);
         DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Channel init. capacity=%lu", this->getId(), capacity);
     }
 
-    bool push(T const& t) {
-        if (useRingBuffer_)
-            return q_.push(t);
-        else {
-            if (lq_.size() >= capacity_)
-                return false;
+    bool push(T && t) {
+        return q_.push(std::move(t));
+    }
 
-            lq_.emplace_back(t);
-            return true;
+    bool pop(T & t) {
+        return q_.pop(t);
+    }
+    
+    // 持有锁时调用: 尽量多地写入, 然后唤醒所有能读到数据的读者.
+    // 调用者在锁外套一层WakeupBatch, 唤醒推迟到放开锁之后批量提交
+    std::size_t pushBatch(T* values, std::size_t n) {
+        std::size_t i = 0;
+        if (!capacity_) {
+            while (i < n && rq_.notify_one([&](T* p){ *p = std::move(values[i]); }))
+                ++i;
+            return i;
         }
+
+        while (i < n && push(std::move(values[i])))
+            ++i;
+
+        while (i > 0 && Size() > 0 && rq_.notify_one([&](T* p){ pop(*p); }))
+            ;
+        return i;
     }
 
-    bool pop(T & t) {
-        if (useRingBuffer_)
-            return q_.pop(t);
-        else {
-            if (lq_.empty())
-                return false;
+    // 持有锁时调用: 尽量多地读取, 然后用等待中的写者的数据填满缓冲区
+    std::size_t popBatch(T* out, std::size_t max) {
+        std::size_t i = 0;
+        while (i < max) {
+            if (capacity_ > 0 && pop(out[i])) {
+                ++i;
+                continue;
+            }
 
-            t = lq_.front();
-            lq_.pop_front();
-            return true;
+            if (wq_.notify_one([&](T* p){ out[i] = std::move(*p); })) {
+                ++i;
+                continue;
+            }
+
+            break;
         }
+
+        while (i > 0 && capacity_ > 0 && Size() < capacity_ &&
+                wq_.notify_one([&](T* p){ push(std::move(*p)); }))
+            ;
+        return i;
     }
-    
+
     // write
-    bool Push(T t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    bool Push(T && t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
     {
         DebugPrint(dbg_channel, "[id=%ld] Push ->", this->getId());
 
@@ -70,12 +90,12 @@ public:
         std::unique_lock<lock_t> lock(lock_);
         if (closed_) return false;
 
-        if (!capacity_ && rq_.notify_one([&](T* p){ *p = t; })) {
+        if (!capacity_ && rq_.notify_one([&](T* p){ *p = std::move(t); })) {
             DebugPrint(dbg_channel, "[id=%ld] Push Notify", this->getId());
             return true;
         }
 
-        if (capacity_ > 0 && push(t)) {
+        if (capacity_ > 0 && push(std::move(t))) {
             if (Size() == 1) {
                 if (rq_.notify_one([&](T* p){ pop(*p); })) {
                     DebugPrint(dbg_channel, "[id=%ld] Push Notify", this->getId());
@@ -131,7 +151,7 @@ public:
         if (capacity_ > 0) {
             if (pop(t)) {
                 if (Size() == capacity_ - 1) {
-                    if (wq_.notify_one([&](T* p){ push(*p); })) {
+                    if (wq_.notify_one([&](T* p){ push(std::move(*p)); })) {
                         DebugPrint(dbg_channel, "[id=%ld] Pop Notify size=%lu.", this->getId(), Size());
                     }
                 }
@@ -139,7 +159,7 @@ public:
                 return true;
             }
         } else {
-            if (wq_.notify_one([&](T* p){ t = *p; })) {
+            if (wq_.notify_one([&](T* p){ t = std::move(*p); })) {
                 DebugPrint(dbg_channel, "[id=%ld] Pop Notify ...", this->getId());
                 return true;
             }
@@ -179,16 +199,86 @@ public:
         return false;
     }
 
+    // batch write
+    std::size_t PushN(T* values, std::size_t n, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] PushN(%lu) ->", this->getId(), n);
+
+        std::size_t count = 0;
+        if (closed_) return count;
+        for (;;) {
+            {
+                // 被唤醒的读者在放开lock_之后按Processer分组一次性唤醒
+                WakeupBatch batch;
+                std::unique_lock<lock_t> lock(lock_);
+                if (closed_) return count;
+
+                count += pushBatch(values + count, n - count);
+                if (count == n || !bWait) {
+                    DebugPrint(dbg_channel, "[id=%ld] PushN complete %lu", this->getId(), count);
+                    return count;
+                }
+            }
+
+            // 缓冲区满了, 等待写入一个之后再继续批量写入
+            if (!Push(std::move(values[count]), true, deadline))
+                return count;
+            ++count;
+        }
+    }
+
+    // batch read
+    std::size_t PopN(T* out, std::size_t max, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] PopN(%lu) ->", this->getId(), max);
+
+        if (closed_ || !max) return 0;
+        std::size_t count = 0;
+        {
+            // 被唤醒的写者在放开lock_之后按Processer分组一次性唤醒
+            WakeupBatch batch;
+            std::unique_lock<lock_t> lock(lock_);
+            if (closed_) return 0;
+
+            count = popBatch(out, max);
+            if (count || !bWait) {
+                DebugPrint(dbg_channel, "[id=%ld] PopN complete %lu", this->getId(), count);
+                return count;
+            }
+        }
+
+        // 没有数据, 等待读到第一个之后把剩余的一次取走
+        if (!Pop(out[0], true, deadline))
+            return 0;
+
+        WakeupBatch batch;
+        std::unique_lock<lock_t> lock(lock_);
+        if (closed_) return 1;
+        count = 1 + popBatch(out + 1, max - 1);
+        DebugPrint(dbg_channel, "[id=%ld] PopN complete %lu", this->getId(), count);
+        return count;
+    }
+
     ~LockedChannelImpl() {
         DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Channel destory.", this->getId());
 
-        assert(lock_.try_lock());
+        // 析构时不能有人持有锁. 直接用std::mutex检查, 不计入PreemptOffDepth
+        bool locked = lock_.std::mutex::try_lock();
+        assert(locked);
+        if (locked) lock_.std::mutex::unlock();
     }
 
     void SetDbgMask(uint64_t mask) {
         dbg_mask_ = mask;
     }
 
+    void SetHandoff(bool b) {
+        wq_.setHandoff(b);
+        rq_.setHandoff(b);
+    }
+
     bool Empty()
     {
         return Size() == 0;
@@ -196,7 +286,7 @@ public:
 
     std::size_t Size()
     {
-        return useRingBuffer_ ? q_.size() : lq_.size();
+        return q_.size();
     }
 
     void Close()
@@ -0,0 +1,26 @@
+#include "parking_lot.h"
+
+namespace co
+{
+
+// 桶的数量, 2的幂
+static const std::size_t kParkingLotBuckets = 1024;
+
+ParkingLot::Bucket& ParkingLot::GetBucket(const void* addr)
+{
+    struct alignas(64) PaddedBucket : public Bucket {};
+    static PaddedBucket buckets[kParkingLotBuckets];
+
+    std::size_t h = (std::size_t)(uintptr_t)addr;
+    h ^= h >> 17;
+    h *= (std::size_t)0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    return buckets[h & (kParkingLotBuckets - 1)];
+}
+
+std::size_t ParkingLot::UnparkAll(const void* addr)
+{
+    return UnparkAll(addr, NoOp());
+}
+
+} //namespace co
@@ -0,0 +1,142 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/clock.h"
+#include "../common/spinlock.h"
+#include "co_condition_variable.h"
+
+namespace co
+{
+
+// 以地址为key的全局等待表(类似WebKit的ParkingLot和linux的futex)
+// 1.同步原语只需要一个状态字, 没有竞争时不会访问ParkingLot, 有竞争时以状态字的地址挂起/唤醒.
+// 2.地址哈希到固定数量的桶, 每个桶一把自旋锁和一个等待队列, 同一个桶内的不同地址共用一个队列.
+// 3.等待节点在等待者的栈上, 挂起和唤醒都没有内存分配. 协程和原生线程都可以使用.
+class ParkingLot
+{
+    // 等待节点的key, token指向等待者栈上的变量, 用于接收唤醒者传来的token
+    struct ParkKey
+    {
+        const void* addr;
+        intptr_t* token;
+    };
+
+    struct Bucket
+    {
+        LFLock lock;
+
+        ConditionVariableAnyT<ParkKey> cv;
+
+        Bucket() { cv.setRelockAfterWait(false); }
+    };
+
+    static Bucket& GetBucket(const void* addr);
+
+    // 入队之后先放开桶锁, 再调用beforeSleep
+    template <typename BeforeSleep>
+    struct ParkLock
+    {
+        LFLock & bucketLock;
+        BeforeSleep const& beforeSleep;
+
+        void lock() { bucketLock.lock(); }
+        void unlock() { bucketLock.unlock(); beforeSleep(); }
+    };
+
+    struct NoOp
+    {
+        void operator()() const {}
+    };
+
+public:
+    struct UnparkResult
+    {
+        bool didUnpark;         // 是否唤醒了一个等待者
+        bool mayHaveMore;       // 该地址上是否可能还有等待者
+        intptr_t token;         // callback可以设置, 传给被唤醒的等待者(例如表示锁已直接交给它)
+    };
+
+    struct ParkResult
+    {
+        bool wasUnparked;       // true表示被Unpark唤醒, false表示validate失败或超时
+        intptr_t token;         // 唤醒者在UnparkOne的callback中设置的token
+    };
+
+    // 持有桶锁时调用validate(), 返回true才挂起; 入队后调用beforeSleep(), 此时不持有任何锁.
+    template <typename Validate, typename BeforeSleep>
+    static ParkResult Park(const void* addr, Validate const& validate, BeforeSleep const& beforeSleep,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        Bucket & bucket = GetBucket(addr);
+        ParkResult result{false, 0};
+        bucket.lock.lock();
+        if (!validate()) {
+            bucket.lock.unlock();
+            return result;
+        }
+
+        ParkLock<BeforeSleep> lock{bucket.lock, beforeSleep};
+        typedef ConditionVariableAnyT<ParkKey> cv_t;
+        typename cv_t::cv_status status;
+        ParkKey key{addr, &result.token};
+        if (deadline == FastSteadyClock::time_point{})
+            status = bucket.cv.wait(lock, key);
+        else
+            status = bucket.cv.wait_util(lock, deadline, key);
+        result.wasUnparked = (status == cv_t::cv_status::no_timeout);
+        return result;
+    }
+
+    template <typename Validate>
+    static ParkResult Park(const void* addr, Validate const& validate,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        return Park(addr, validate, NoOp(), deadline);
+    }
+
+    // 唤醒一个在addr上等待的协程.
+    // callback(UnparkResult&)在持有桶锁时、被唤醒者开始运行之前调用, 用于更新状态字.
+    template <typename Callback>
+    static UnparkResult UnparkOne(const void* addr, Callback const& callback)
+    {
+        Bucket & bucket = GetBucket(addr);
+        std::unique_lock<LFLock> lock(bucket.lock);
+        auto match = [=](ParkKey const& key) { return key.addr == addr; };
+        UnparkResult result{false, false, 0};
+        bool notified = bucket.cv.notify_one_if(match, [&](ParkKey & key) {
+                result.didUnpark = true;
+                result.mayHaveMore = bucket.cv.any_of(match);
+                callback(result);
+                *key.token = result.token;
+            });
+        if (!notified)
+            callback(result);
+        return result;
+    }
+
+    static UnparkResult UnparkOne(const void* addr)
+    {
+        return UnparkOne(addr, [](UnparkResult) {});
+    }
+
+    // 唤醒所有在addr上等待的协程, 返回唤醒的个数.
+    // callback()在持有桶锁时、唤醒之前调用, 此时新来的等待者还不能validate, 用于清除"有等待者"标记.
+    template <typename Callback>
+    static std::size_t UnparkAll(const void* addr, Callback const& callback)
+    {
+        // 放开桶锁之后再批量唤醒
+        WakeupBatch batch;
+        Bucket & bucket = GetBucket(addr);
+        std::unique_lock<LFLock> lock(bucket.lock);
+        callback();
+        auto match = [=](ParkKey const& key) { return key.addr == addr; };
+        auto noop = [](ParkKey &) {};
+        std::size_t n = 0;
+        while (bucket.cv.notify_one_if(match, noop))
+            ++n;
+        return n;
+    }
+
+    static std::size_t UnparkAll(const void* addr);
+};
+
+} //namespace co
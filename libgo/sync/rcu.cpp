@@ -0,0 +1,141 @@
+#include "rcu.h"
+#include "../scheduler/processer.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace co
+{
+
+// 宽限期序号从1开始, 0表示离线
+atomic_t<uint64_t> Rcu::s_gpCounter{1};
+
+// 所有读者. 协程中也会加锁(Synchronize), 用RuntimeMutex, 持有期间不被抢占
+static RuntimeMutex & RegistryMutex()
+{
+    static RuntimeMutex mtx;
+    return mtx;
+}
+
+static RcuReader* & RegistryHead()
+{
+    static RcuReader* head = nullptr;
+    return head;
+}
+
+void Rcu::Register(RcuReader* reader, bool inScheduler)
+{
+    std::unique_lock<RuntimeMutex> lock(RegistryMutex());
+    RcuReader* & head = RegistryHead();
+    reader->prev = nullptr;
+    reader->next = head;
+    if (head) head->prev = reader;
+    head = reader;
+    GetThreadState().inScheduler = inScheduler;
+}
+
+void Rcu::Unregister(RcuReader* reader)
+{
+    Offline(*reader);
+    std::unique_lock<RuntimeMutex> lock(RegistryMutex());
+    if (reader->prev) reader->prev->next = reader->next;
+    else RegistryHead() = reader->next;
+    if (reader->next) reader->next->prev = reader->prev;
+    reader->prev = reader->next = nullptr;
+    GetThreadState().inScheduler = false;
+}
+
+// 原生线程退出时注销读者
+struct NativeRcuReader
+{
+    RcuReader reader;
+
+    NativeRcuReader() { Rcu::Register(&reader, false); }
+    ~NativeRcuReader() { Rcu::Unregister(&reader); }
+};
+
+void Rcu::NativeOnline(ThreadState & state)
+{
+    if (!state.reader) {
+        static thread_local NativeRcuReader native;
+        state.reader = &native.reader;
+    }
+    Online(*state.reader);
+}
+
+void Rcu::Synchronize()
+{
+    assert(GetThreadState().depth == 0);
+
+    uint64_t gp = s_gpCounter.fetch_add(1, std::memory_order_seq_cst) + 1;
+    for (;;) {
+        bool done = true;
+        {
+            std::unique_lock<RuntimeMutex> lock(RegistryMutex());
+            for (RcuReader* reader = RegistryHead(); reader; reader = reader->next) {
+                uint64_t ctr = reader->ctr.load(std::memory_order_acquire);
+                if (ctr != 0 && ctr < gp) {
+                    done = false;
+                    break;
+                }
+            }
+        }
+
+        if (done)
+            return ;
+
+        // 协程中挂起等待, 当前调度线程切换协程时也就经过了静止状态
+        if (Processer::IsCoroutine()) {
+            Processer::Suspend(std::chrono::milliseconds(1));
+            Processer::StaticCoYield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+// 后台回收线程: 攒一批回调, 等一个宽限期, 然后依次执行
+struct RcuReclaimer
+{
+    RuntimeMutex mtx;   // Rcu::Call可能在协程中调用
+    std::condition_variable_any cv;
+    std::vector<std::function<void()>> pending;
+    bool started = false;
+
+    static RcuReclaimer & getInstance()
+    {
+        static RcuReclaimer *obj = new RcuReclaimer;
+        return *obj;
+    }
+
+    void ThreadRun()
+    {
+        for (;;) {
+            std::vector<std::function<void()>> batch;
+            {
+                std::unique_lock<RuntimeMutex> lock(mtx);
+                cv.wait(lock, [this]{ return !pending.empty(); });
+                batch.swap(pending);
+            }
+
+            Rcu::Synchronize();
+            for (auto & cb : batch)
+                cb();
+        }
+    }
+};
+
+void Rcu::Call(std::function<void()> const& cb)
+{
+    RcuReclaimer & reclaimer = RcuReclaimer::getInstance();
+    std::unique_lock<RuntimeMutex> lock(reclaimer.mtx);
+    reclaimer.pending.push_back(cb);
+    if (!reclaimer.started) {
+        reclaimer.started = true;
+        std::thread([&reclaimer]{ reclaimer.ThreadRun(); }).detach();
+    }
+    reclaimer.cv.notify_one();
+}
+
+} //namespace co
@@ -0,0 +1,162 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/spinlock.h"
+#include <functional>
+
+namespace co
+{
+
+// RCU读者的状态: 每个调度线程一个, 在协程外使用RCU的原生线程每个线程一个
+struct RcuReader
+{
+    // 0表示离线: 不在读临界区中, 宽限期不需要等待它.
+    // 否则是最近一次经过静止状态时看到的宽限期序号.
+    atomic_t<uint64_t> ctr{0};
+
+    RcuReader* prev = nullptr;
+    RcuReader* next = nullptr;
+};
+
+/// RCU(Read-Copy-Update), 基于静止状态(QSBR)
+// 1.协程中的读者没有任何开销: 调度线程每次切换协程、空闲等待时都经过了一次静止状态,
+//   只要求读临界区内不切换协程(不yield, 不阻塞在channel/锁/sleep/IO上), 读临界区内也不会被异步抢占.
+// 2.写者发布新版本后调用Synchronize等待一个宽限期(所有读者都经过一次静止状态), 之后就可以释放旧版本;
+//   也可以用Call把释放推迟到宽限期之后, 由后台线程批量执行.
+// 3.协程外(原生线程)的读者进出读临界区时上线/下线, 上线时有一次内存屏障.
+class Rcu
+{
+    // 线程局部状态, 平凡类型, 访问时没有初始化检查
+    struct ThreadState
+    {
+        bool inScheduler;       // 是否调度线程
+        int depth;              // 原生线程的读临界区嵌套层数
+        RcuReader* reader;      // 原生线程的读者状态, 第一次使用时创建
+    };
+
+    static ThreadState & GetThreadState()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    static atomic_t<uint64_t> s_gpCounter;
+
+public:
+    // 读临界区, 可以嵌套. 在协程中只禁止异步抢占.
+    ALWAYS_INLINE static void ReadLock()
+    {
+        ThreadState & state = GetThreadState();
+        if (state.inScheduler) {
+            ++ PreemptOffDepth();
+            return;
+        }
+        if (state.depth++ == 0) NativeOnline(state);
+    }
+
+    ALWAYS_INLINE static void ReadUnlock()
+    {
+        ThreadState & state = GetThreadState();
+        if (state.inScheduler) {
+            -- PreemptOffDepth();
+            return;
+        }
+        assert(state.depth > 0);
+        if (--state.depth == 0) Offline(*state.reader);
+    }
+
+    // 等待此前开始的读临界区全部结束. 不能在读临界区内调用.
+    // 在协程中调用时挂起当前协程等待, 不阻塞调度线程.
+    static void Synchronize();
+
+    // 宽限期结束后在后台线程中调用cb(通常是释放旧版本)
+    static void Call(std::function<void()> const& cb);
+
+public:
+    // 以下由调度线程使用
+    static void Register(RcuReader* reader, bool inScheduler);
+    static void Unregister(RcuReader* reader);
+
+    // 切换协程时调用, 读者看到最新的宽限期序号
+    ALWAYS_INLINE static void QuiescentState(RcuReader & reader)
+    {
+        reader.ctr.store(s_gpCounter.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // 空闲等待前下线, 醒来后上线.
+    // 上线之后的读不能重排到上线之前, 否则写者可能看到离线而释放了正在读的数据.
+    ALWAYS_INLINE static void Offline(RcuReader & reader)
+    {
+        reader.ctr.store(0, std::memory_order_release);
+    }
+
+    ALWAYS_INLINE static void Online(RcuReader & reader)
+    {
+        reader.ctr.store(s_gpCounter.load(std::memory_order_acquire), std::memory_order_seq_cst);
+    }
+
+private:
+    static void NativeOnline(ThreadState & state);
+};
+
+// 读临界区的guard
+class RcuReadLock
+{
+public:
+    RcuReadLock() { Rcu::ReadLock(); }
+    ~RcuReadLock() { Rcu::ReadUnlock(); }
+
+    RcuReadLock(RcuReadLock const&) = delete;
+    RcuReadLock& operator=(RcuReadLock const&) = delete;
+};
+
+// 受RCU保护的指针: 读者在读临界区内get(), 写者reset()发布新版本, 旧版本在宽限期后释放
+template <typename T>
+class RcuPtr
+{
+    atomic_t<T*> ptr_;
+
+public:
+    explicit RcuPtr(T* ptr = nullptr) : ptr_(ptr) {}
+
+    // 析构时不能再有读者
+    ~RcuPtr() { delete ptr_.load(std::memory_order_relaxed); }
+
+    RcuPtr(RcuPtr const&) = delete;
+    RcuPtr& operator=(RcuPtr const&) = delete;
+
+    // 返回的指针在读临界区结束之前有效
+    T* get() const
+    {
+        return ptr_.load(std::memory_order_acquire);
+    }
+
+    T* operator->() const { return get(); }
+
+    // 发布新版本并返回旧版本, 调用者在Synchronize之后才能释放旧版本
+    T* exchange(T* ptr)
+    {
+        return ptr_.exchange(ptr, std::memory_order_acq_rel);
+    }
+
+    // 发布新版本, 旧版本在宽限期后由后台线程释放
+    void reset(T* ptr)
+    {
+        T* old = exchange(ptr);
+        if (old)
+            Rcu::Call([old]{ delete old; });
+    }
+};
+
+inline void synchronize_rcu()
+{
+    Rcu::Synchronize();
+}
+
+inline void call_rcu(std::function<void()> const& cb)
+{
+    Rcu::Call(cb);
+}
+
+typedef RcuReadLock co_rcu_read_lock;
+
+} //namespace co
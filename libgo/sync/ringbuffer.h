@@ -19,8 +19,10 @@ public:
         read_ = 0;
     }
     ~RingBuffer() {
-        T t;
-        while (pop(t));
+        while (!empty()) {
+            (buf_ + pread())->~T();
+            ++read_;
+        }
         free(buf_);
     }
 
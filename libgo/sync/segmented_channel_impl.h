@@ -0,0 +1,271 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/segment_queue.h"
+#include "channel_impl.h"
+#include "co_condition_variable.h"
+
+namespace co
+{
+
+// 大容量(或无界)的Channel
+// 1.数据存放在无锁的SegmentQueue中, 读写都不加锁, 也不会为每个元素分配内存.
+// 2.只有读空或写满时才挂起, 挂起和唤醒通过等待计数做Dekker式的握手, 快速路径上只有一次原子读.
+// 3.capacity为(size_t)-1时相当于无界.
+template <typename T>
+class SegmentedChannelImpl : public ChannelImpl<T>
+{
+    typedef RuntimeMutex lock_t;
+    typedef FastSteadyClock::time_point time_point_t;
+
+    const std::size_t capacity_;
+    atomic_t<bool> closed_{false};
+    uint64_t dbg_mask_;
+
+    SegmentQueue<T> q_;
+
+    // size_: 写者先预留再写入, 用于容量限制; count_: 已经写完、读者可以取走的元素数.
+    // 读者按count_判断是否需要挂起, 否则写者预留之后、写完之前, 读者会一直空转.
+    atomic_t<std::size_t> size_{0};
+    atomic_t<std::size_t> count_{0};
+
+    // 挂起(只在空/满时使用)
+    atomic_t<int> readWaiting_{0};
+    atomic_t<int> writeWaiting_{0};
+    lock_t lock_;
+    ConditionVariableAny rcv_;
+    ConditionVariableAny wcv_;
+
+public:
+    explicit SegmentedChannelImpl(std::size_t capacity)
+        : capacity_(capacity), dbg_mask_(dbg_all)
+    {
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Segmented Channel init. capacity=%lu", this->getId(), capacity);
+    }
+
+    ~SegmentedChannelImpl() {
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Segmented Channel destory.", this->getId());
+    }
+
+    // write
+    bool Push(T && t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] Push ->", this->getId());
+
+        for (;;) {
+            if (closed_.load(std::memory_order_relaxed))
+                return false;
+
+            std::size_t size = size_.load(std::memory_order_relaxed);
+            if (size < capacity_) {
+                if (!size_.compare_exchange_weak(size, size + 1,
+                            std::memory_order_relaxed, std::memory_order_relaxed))
+                    continue;
+
+                q_.Push(std::move(t));
+                count_.fetch_add(1, std::memory_order_relaxed);
+                wakeup(readWaiting_, rcv_);
+                DebugPrint(dbg_channel, "[id=%ld] Push complete.", this->getId());
+                return true;
+            }
+
+            // 满了
+            if (!bWait) {
+                DebugPrint(dbg_channel, "[id=%ld] TryPush failed.", this->getId());
+                return false;
+            }
+
+            if (!park(writeWaiting_, wcv_, deadline, [&]{
+                        return size_.load(std::memory_order_relaxed) < capacity_;
+                        }))
+                return false;
+        }
+    }
+
+    // read
+    bool Pop(T & t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] Pop ->", this->getId());
+
+        for (;;) {
+            if (closed_.load(std::memory_order_relaxed))
+                return false;
+
+            if (q_.Pop(t)) {
+                count_.fetch_sub(1, std::memory_order_relaxed);
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                wakeup(writeWaiting_, wcv_);
+                DebugPrint(dbg_channel, "[id=%ld] Pop complete.", this->getId());
+                return true;
+            }
+
+            // 空了
+            if (!bWait) {
+                DebugPrint(dbg_channel, "[id=%ld] TryPop failed.", this->getId());
+                return false;
+            }
+
+            if (!park(readWaiting_, rcv_, deadline, [&]{
+                        return count_.load(std::memory_order_relaxed) > 0;
+                        }))
+                return false;
+        }
+    }
+
+    // 一次预留k个位置, 写完后只做一次唤醒检查
+    std::size_t PushN(T* values, std::size_t n, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] PushN %lu ->", this->getId(), n);
+
+        std::size_t pushed = 0;
+        while (pushed < n) {
+            if (closed_.load(std::memory_order_relaxed))
+                break;
+
+            std::size_t size = size_.load(std::memory_order_relaxed);
+            if (size < capacity_) {
+                std::size_t k = (std::min)(n - pushed, capacity_ - size);
+                if (!size_.compare_exchange_weak(size, size + k,
+                            std::memory_order_relaxed, std::memory_order_relaxed))
+                    continue;
+
+                for (std::size_t i = 0; i < k; ++i)
+                    q_.Push(std::move(values[pushed + i]));
+                count_.fetch_add(k, std::memory_order_relaxed);
+                wakeup(readWaiting_, rcv_, k);
+                pushed += k;
+                continue;
+            }
+
+            // 满了
+            if (!bWait)
+                break;
+
+            if (!park(writeWaiting_, wcv_, deadline, [&]{
+                        return size_.load(std::memory_order_relaxed) < capacity_;
+                        }))
+                break;
+        }
+
+        DebugPrint(dbg_channel, "[id=%ld] PushN complete %lu", this->getId(), pushed);
+        return pushed;
+    }
+
+    // 有多少读多少, 读完后一次性归还容量并唤醒写者
+    std::size_t PopN(T* out, std::size_t max, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] PopN %lu ->", this->getId(), max);
+
+        for (;;) {
+            if (closed_.load(std::memory_order_relaxed))
+                return 0;
+
+            std::size_t popped = 0;
+            while (popped < max && q_.Pop(out[popped]))
+                ++popped;
+
+            if (popped) {
+                count_.fetch_sub(popped, std::memory_order_relaxed);
+                size_.fetch_sub(popped, std::memory_order_relaxed);
+                wakeup(writeWaiting_, wcv_, popped);
+                DebugPrint(dbg_channel, "[id=%ld] PopN complete %lu", this->getId(), popped);
+                return popped;
+            }
+
+            // 空了
+            if (!bWait || !max)
+                return 0;
+
+            if (!park(readWaiting_, rcv_, deadline, [&]{
+                        return count_.load(std::memory_order_relaxed) > 0;
+                        }))
+                return 0;
+        }
+    }
+
+    void SetDbgMask(uint64_t mask) {
+        dbg_mask_ = mask;
+    }
+
+    void SetHandoff(bool b) {
+        rcv_.setHandoff(b);
+        wcv_.setHandoff(b);
+    }
+
+    bool Empty()
+    {
+        return Size() == 0;
+    }
+
+    std::size_t Size()
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    void Close()
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        if (closed_) return ;
+
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Segmented Channel Closed. size=%d", this->getId(), (int)Size());
+
+        closed_ = true;
+        rcv_.notify_all();
+        wcv_.notify_all();
+    }
+
+private:
+    // 挂起等待对端, 返回false表示超时或已关闭.
+    // 先登记等待计数再检查条件, 对端先修改数据再检查等待计数, 两边之间各有一个全屏障.
+    template <typename Ready>
+    bool park(atomic_t<int> & waiting, ConditionVariableAny & cv,
+            time_point_t deadline, Ready const& ready)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (closed_ || ready()) {
+            waiting.fetch_sub(1, std::memory_order_relaxed);
+            return !closed_;
+        }
+
+        DebugPrint(dbg_channel, "[id=%ld] Segmented wait.", this->getId());
+
+        ConditionVariableAny::cv_status cv_status;
+        if (deadline == time_point_t())
+            cv_status = cv.wait(lock);
+        else
+            cv_status = cv.wait_util(lock, deadline);
+
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        if (closed_)
+            return false;
+
+        return cv_status != ConditionVariableAny::cv_status::timeout || ready();
+    }
+
+    // 至多唤醒n个等待者
+    void wakeup(atomic_t<int> & waiting, ConditionVariableAny & cv, std::size_t n = 1)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!waiting.load(std::memory_order_relaxed))
+            return ;
+
+        if (n == 1) {
+            // 等待者持有锁直到进入等待队列
+            std::unique_lock<lock_t> lock(lock_);
+            cv.notify_one();
+            return ;
+        }
+
+        // 放开锁之后再批量提交唤醒
+        WakeupBatch batch;
+        std::unique_lock<lock_t> lock(lock_);
+        for (std::size_t i = 0; i < n; ++i)
+            if (!cv.notify_one())
+                break;
+    }
+};
+
+} //namespace co
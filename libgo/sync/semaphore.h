@@ -0,0 +1,102 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/clock.h"
+#include "parking_lot.h"
+
+namespace co
+{
+
+/// 计数信号量
+// 一个字的状态: 高位是可用的计数, 最低位表示有等待者.
+// acquire/release只有一次原子操作; release时有等待者就在ParkingLot中一次唤醒所有等待者,
+// 被唤醒者重新竞争, 计数不够的重新挂起(等待者需要的数量可能不同, 只唤醒一个可能唤醒了不够用的那个).
+// 协程和原生线程都可以等待.
+class Semaphore
+{
+    static const uint64_t kWaiters = 0x1;
+    static const uint64_t kOne = 0x2;
+
+    atomic_t<uint64_t> state_;
+
+public:
+    explicit Semaphore(std::size_t count = 0)
+        : state_(count * kOne)
+    {
+    }
+
+    Semaphore(Semaphore const&) = delete;
+    Semaphore& operator=(Semaphore const&) = delete;
+
+    void acquire(std::size_t n = 1)
+    {
+        acquire(n, FastSteadyClock::time_point{});
+    }
+
+    bool try_acquire(std::size_t n = 1)
+    {
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        while (state / kOne >= n) {
+            if (state_.compare_exchange_weak(state, state - n * kOne,
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    template <typename Rep, typename Period>
+    bool try_acquire_for(std::chrono::duration<Rep, Period> dur, std::size_t n = 1)
+    {
+        return try_acquire_until(FastSteadyClock::now() +
+                std::chrono::duration_cast<FastSteadyClock::duration>(dur), n);
+    }
+
+    bool try_acquire_until(FastSteadyClock::time_point deadline, std::size_t n = 1)
+    {
+        return acquire(n, deadline);
+    }
+
+    void release(std::size_t n = 1)
+    {
+        uint64_t state = state_.fetch_add(n * kOne, std::memory_order_release);
+        if (state & kWaiters) {
+            // 在桶锁内清除等待标记, 新的等待者要么已经入队(会被唤醒), 要么在此之后重新标记
+            ParkingLot::UnparkAll(this, [this]{
+                    state_.fetch_and(~kWaiters, std::memory_order_relaxed);
+                    });
+        }
+    }
+
+    std::size_t available() const
+    {
+        return (std::size_t)(state_.load(std::memory_order_relaxed) / kOne);
+    }
+
+private:
+    bool acquire(std::size_t n, FastSteadyClock::time_point deadline)
+    {
+        for (;;) {
+            if (try_acquire(n))
+                return true;
+
+            ParkingLot::Park(this, [=]{
+                    // 持有桶锁, 计数仍然不够才标记并挂起
+                    uint64_t state = state_.load(std::memory_order_relaxed);
+                    while (state / kOne < n) {
+                        if (state & kWaiters)
+                            return true;
+                        if (state_.compare_exchange_weak(state, state | kWaiters,
+                                    std::memory_order_relaxed, std::memory_order_relaxed))
+                            return true;
+                    }
+                    return false;
+                    }, deadline);
+
+            if (deadline != FastSteadyClock::time_point{} && FastSteadyClock::now() >= deadline)
+                return try_acquire(n);
+        }
+    }
+};
+
+typedef Semaphore co_semaphore;
+
+} //namespace co
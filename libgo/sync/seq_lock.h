@@ -0,0 +1,99 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/spinlock.h"
+#include "../scheduler/processer.h"
+#include "co_mutex.h"
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace co
+{
+
+/// 顺序锁
+// 适合很小的、可平凡复制的读多写少数据(计数器, 配置结构体, 行情快照等), 读比读写锁更便宜:
+// 1.读者不写任何共享内存, 乐观地拷贝一份数据, 拷贝前后版本号不一致(期间有写者)就重试.
+// 2.写者之间用CoMutex互斥, 等待的写者挂起协程(Processer::Suspend), 不会空转占住调度线程.
+//   写时版本号先变为奇数, 写完变为偶数.
+// 3.读者遇到写到一半的数据时短暂自旋, 仍未写完就让出(协程中yield, 线程中yield).
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock<T> requires trivially copyable T");
+
+    // 读者遇到写者时先自旋的次数
+    static const int kSpinLimit = 64;
+
+    atomic_t<uint32_t> seq_{0};
+    CoMutex writeMutex_;
+    T data_;
+
+public:
+    SeqLock() : data_() {}
+    explicit SeqLock(T const& value) : data_(value) {}
+
+    SeqLock(SeqLock const&) = delete;
+    SeqLock& operator=(SeqLock const&) = delete;
+
+    T Load() const
+    {
+        T value;
+        int spin = 0;
+        for (;;) {
+            uint32_t seq = seq_.load(std::memory_order_acquire);
+            if (seq & 1) {
+                waitWriter(spin);
+                continue;
+            }
+
+            // 与写者并发时拷贝到的可能是不一致的数据, 版本号校验失败后丢弃
+            std::memcpy((void*)&value, (const void*)&data_, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == seq)
+                return value;
+        }
+    }
+
+    void Store(T const& value)
+    {
+        Update([&](T & data) { data = value; });
+    }
+
+    // 持有写锁时调用fn(T&)原地修改, 用于读-改-写. fn中不要切换协程, 否则读者会一直重试.
+    template <typename F>
+    void Update(F const& fn)
+    {
+        std::unique_lock<CoMutex> lock(writeMutex_);
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        fn(data_);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // 写的次数
+    uint32_t Version() const
+    {
+        return seq_.load(std::memory_order_acquire) >> 1;
+    }
+
+private:
+    static void waitWriter(int & spin)
+    {
+        if (++spin < kSpinLimit) {
+            CpuRelax();
+            return ;
+        }
+
+        spin = 0;
+        if (Processer::IsCoroutine())
+            Processer::StaticCoYield();
+        else
+            std::this_thread::yield();
+    }
+};
+
+template <typename T>
+using co_seqlock = SeqLock<T>;
+
+} //namespace co
@@ -0,0 +1,245 @@
+#pragma once
+#include "../common/config.h"
+#include "channel_impl.h"
+#include "co_condition_variable.h"
+
+namespace co
+{
+
+// 单生产者单消费者(SPSC)的Channel
+// 1.只允许一个协程(或线程)写入, 一个协程(或线程)读取, 否则行为未定义.
+// 2.环形缓冲区的读写是wait-free的, 只在空(读)或满(写)时才挂起.
+// 3.tail_只由生产者写, head_只由消费者写, 各自缓存对方的位置以减少cache line的来回同步.
+// 4.不支持capacity=0, 由Channel选择LockedChannelImpl.
+template <typename T>
+class SpscChannelImpl : public ChannelImpl<T>
+{
+    typedef RuntimeMutex lock_t;
+    typedef FastSteadyClock::time_point time_point_t;
+    static const std::size_t kCacheLineSize = 64;
+
+    // ---------- 只读区
+    const std::size_t capacity_;
+    T* buf_;
+    uint64_t dbg_mask_;
+    atomic_t<bool> closed_{false};
+    char pad0_[kCacheLineSize];
+
+    // ---------- 生产者独占
+    atomic_t<std::size_t> tail_{0};
+    std::size_t writePos_ = 0;      // tail_对应的buf_下标
+    std::size_t cachedHead_ = 0;    // 生产者缓存的head_
+    char pad1_[kCacheLineSize];
+
+    // ---------- 消费者独占
+    atomic_t<std::size_t> head_{0};
+    std::size_t readPos_ = 0;       // head_对应的buf_下标
+    std::size_t cachedTail_ = 0;    // 消费者缓存的tail_
+    char pad2_[kCacheLineSize];
+
+    // ---------- 挂起(只在空/满时使用)
+    atomic_t<bool> readerWaiting_{false};
+    atomic_t<bool> writerWaiting_{false};
+    lock_t lock_;
+    ConditionVariableAny cv_;
+
+public:
+    explicit SpscChannelImpl(std::size_t capacity)
+        : capacity_(capacity), dbg_mask_(dbg_all)
+    {
+        assert(capacity_ > 0);
+        buf_ = (T*)malloc(sizeof(T) * capacity_);
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Spsc Channel init. capacity=%lu", this->getId(), capacity);
+    }
+
+    ~SpscChannelImpl() {
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Spsc Channel destory.", this->getId());
+
+        std::size_t n = tail_ - head_;
+        for (std::size_t i = 0; i < n; ++i) {
+            buf_[readPos_].~T();
+            if (++readPos_ == capacity_) readPos_ = 0;
+        }
+        free(buf_);
+    }
+
+    // write
+    bool Push(T && t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        return PushN(&t, 1, bWait, deadline) == 1;
+    }
+
+    // read
+    bool Pop(T & t, bool bWait, FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        return PopN(&t, 1, bWait, deadline) == 1;
+    }
+
+    // batch write: 写入多个数据只需发布一次tail_
+    std::size_t PushN(T* values, std::size_t n, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] Push(%lu) ->", this->getId(), n);
+
+        std::size_t count = 0;
+        while (count < n) {
+            if (closed_.load(std::memory_order_relaxed))
+                break;
+
+            std::size_t tail = tail_.load(std::memory_order_relaxed);
+            std::size_t writable = capacity_ - (tail - cachedHead_);
+            if (writable < n - count) {
+                cachedHead_ = head_.load(std::memory_order_acquire);
+                writable = capacity_ - (tail - cachedHead_);
+            }
+
+            if (writable) {
+                std::size_t k = (std::min)(writable, n - count);
+                for (std::size_t i = 0; i < k; ++i) {
+                    new (buf_ + writePos_) T(std::move(values[count + i]));
+                    if (++writePos_ == capacity_) writePos_ = 0;
+                }
+                tail_.store(tail + k, std::memory_order_release);
+                count += k;
+                wakeup(readerWaiting_);
+                continue;
+            }
+
+            // 满了
+            if (!bWait)
+                break;
+
+            if (!park(writerWaiting_, deadline, [&]{
+                        return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) < capacity_;
+                        }))
+                break;
+        }
+
+        DebugPrint(dbg_channel, "[id=%ld] Push complete %lu", this->getId(), count);
+        return count;
+    }
+
+    // batch read: 读出多个数据只需发布一次head_, 只等待第一个数据
+    std::size_t PopN(T* out, std::size_t max, bool bWait,
+            FastSteadyClock::time_point deadline = FastSteadyClock::time_point{})
+    {
+        DebugPrint(dbg_channel, "[id=%ld] Pop(%lu) ->", this->getId(), max);
+
+        if (!max) return 0;
+
+        for (;;) {
+            if (closed_.load(std::memory_order_relaxed))
+                return 0;
+
+            std::size_t head = head_.load(std::memory_order_relaxed);
+            std::size_t readable = cachedTail_ - head;
+            if (readable < max) {
+                cachedTail_ = tail_.load(std::memory_order_acquire);
+                readable = cachedTail_ - head;
+            }
+
+            if (readable) {
+                std::size_t k = (std::min)(readable, max);
+                for (std::size_t i = 0; i < k; ++i) {
+                    T* p = buf_ + readPos_;
+                    out[i] = std::move(*p);
+                    p->~T();
+                    if (++readPos_ == capacity_) readPos_ = 0;
+                }
+                head_.store(head + k, std::memory_order_release);
+                wakeup(writerWaiting_);
+                DebugPrint(dbg_channel, "[id=%ld] Pop complete %lu", this->getId(), k);
+                return k;
+            }
+
+            // 空了
+            if (!bWait)
+                return 0;
+
+            if (!park(readerWaiting_, deadline, [&]{
+                        return tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_relaxed);
+                        }))
+                return 0;
+        }
+    }
+
+    void SetDbgMask(uint64_t mask) {
+        dbg_mask_ = mask;
+    }
+
+    void SetHandoff(bool b) {
+        cv_.setHandoff(b);
+    }
+
+    bool Empty()
+    {
+        return Size() == 0;
+    }
+
+    std::size_t Size()
+    {
+        std::size_t head = head_.load(std::memory_order_acquire);
+        std::size_t tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    void Close()
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        if (closed_) return ;
+
+        DebugPrint(dbg_mask_ & dbg_channel, "[id=%ld] Spsc Channel Closed. size=%d", this->getId(), (int)Size());
+
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    // 挂起等待对端, 返回false表示超时或已关闭.
+    // 与wakeup构成Dekker式的握手: 先置等待标记再检查条件, 对端先发布数据再检查等待标记,
+    // 两边之间各有一个全屏障, 保证至少有一方能看到对方的写入, 不会丢失唤醒.
+    template <typename Ready>
+    bool park(atomic_t<bool> & waiting, time_point_t deadline, Ready const& ready)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (closed_) {
+            waiting.store(false, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (ready()) {
+            waiting.store(false, std::memory_order_relaxed);
+            return true;
+        }
+
+        DebugPrint(dbg_channel, "[id=%ld] Spsc wait.", this->getId());
+
+        ConditionVariableAny::cv_status cv_status;
+        if (deadline == time_point_t())
+            cv_status = cv_.wait(lock);
+        else
+            cv_status = cv_.wait_util(lock, deadline);
+
+        waiting.store(false, std::memory_order_relaxed);
+        if (closed_)
+            return false;
+
+        return cv_status != ConditionVariableAny::cv_status::timeout || ready();
+    }
+
+    void wakeup(atomic_t<bool> & waiting)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!waiting.load(std::memory_order_relaxed))
+            return ;
+
+        // 对端持有锁直到进入等待队列, 拿到锁时它一定已在等待或已看到新数据
+        std::unique_lock<lock_t> lock(lock_);
+        if (waiting.exchange(false, std::memory_order_relaxed))
+            cv_.notify_one();
+    }
+};
+
+} //namespace co
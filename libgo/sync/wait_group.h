@@ -0,0 +1,131 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/clock.h"
+#include "parking_lot.h"
+
+namespace co
+{
+
+/// 等待一组任务完成(与Go的sync.WaitGroup相同)
+// 一个字的状态: 高32位是计数, 最低位表示有等待者.
+// Add/Done只有一次原子操作, 计数归零并且有等待者时, 在ParkingLot中一次唤醒所有等待者.
+// 协程和原生线程都可以等待.
+class WaitGroup
+{
+    static const uint64_t kWaiters = 0x1;
+    static const int kCountShift = 32;
+
+    atomic_t<uint64_t> state_{0};
+
+public:
+    explicit WaitGroup(int count = 0)
+        : state_((uint64_t)count << kCountShift)
+    {
+        assert(count >= 0);
+    }
+
+    WaitGroup(WaitGroup const&) = delete;
+    WaitGroup& operator=(WaitGroup const&) = delete;
+
+    void Add(int delta = 1)
+    {
+        uint64_t state = state_.fetch_add((uint64_t)(int64_t)delta << kCountShift,
+                std::memory_order_acq_rel);
+        int count = (int)(state >> kCountShift) + delta;
+        assert(count >= 0);
+        if (count == 0 && (state & kWaiters)) {
+            // 在桶锁内清除等待标记, 新的等待者要么已经入队(会被唤醒), 要么在此之后重新标记
+            ParkingLot::UnparkAll(this, [this]{
+                    state_.fetch_and(~kWaiters, std::memory_order_relaxed);
+                    });
+        }
+    }
+
+    void Done()
+    {
+        Add(-1);
+    }
+
+    int Count() const
+    {
+        return (int)(state_.load(std::memory_order_acquire) >> kCountShift);
+    }
+
+    void Wait()
+    {
+        wait(FastSteadyClock::time_point{});
+    }
+
+    // 超时返回false
+    template <typename Rep, typename Period>
+    bool WaitFor(std::chrono::duration<Rep, Period> dur)
+    {
+        return WaitUntil(FastSteadyClock::now() +
+                std::chrono::duration_cast<FastSteadyClock::duration>(dur));
+    }
+
+    bool WaitUntil(FastSteadyClock::time_point deadline)
+    {
+        return wait(deadline);
+    }
+
+private:
+    bool wait(FastSteadyClock::time_point deadline)
+    {
+        for (;;) {
+            if (Count() == 0)
+                return true;
+
+            ParkingLot::Park(this, [this]{
+                    // 持有桶锁, 计数不为0才标记并挂起
+                    uint64_t state = state_.load(std::memory_order_relaxed);
+                    while (state >> kCountShift) {
+                        if (state & kWaiters)
+                            return true;
+                        if (state_.compare_exchange_weak(state, state | kWaiters,
+                                    std::memory_order_relaxed, std::memory_order_relaxed))
+                            return true;
+                    }
+                    return false;
+                    }, deadline);
+
+            if (deadline != FastSteadyClock::time_point{} && FastSteadyClock::now() >= deadline)
+                return Count() == 0;
+        }
+    }
+};
+
+/// 一次性的倒计数门闩(与C++20的std::latch相同)
+class Latch
+{
+    WaitGroup wg_;
+
+public:
+    explicit Latch(int count) : wg_(count) {}
+
+    void count_down(int n = 1)
+    {
+        wg_.Add(-n);
+    }
+
+    bool try_wait() const
+    {
+        return wg_.Count() == 0;
+    }
+
+    void wait()
+    {
+        wg_.Wait();
+    }
+
+    void arrive_and_wait(int n = 1)
+    {
+        count_down(n);
+        wait();
+    }
+};
+
+typedef WaitGroup co_wait_group;
+typedef Latch co_latch;
+
+} //namespace co
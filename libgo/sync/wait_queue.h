@@ -6,29 +6,26 @@
 namespace co
 {
 
+// 侵入式的等待队列节点, 内存由使用者管理(通常就在等待者的栈上)
 struct WaitQueueHook
 {
+    WaitQueueHook* prev = nullptr;
     WaitQueueHook* next = nullptr;
+    void* owner = nullptr;  // 所在的队列, 不在队列中时为nullptr
 };
 
+// 等待队列
+// 1.双向链表, 等待者超时后可以把自己从队列中间摘掉, 不再需要定期清理过期节点.
+// 2.临界区只有几次指针操作, 用自旋锁保护.
+// 3.前posDistance-1个节点不需要等待(相当于缓冲区), pos_指向第一个需要等待的节点.
+//   每pop一个节点, 就通过onPos回调把pos_转为不需要等待的节点.
 template <typename T>
 class WaitQueue
 {
     static_assert(std::is_base_of<WaitQueueHook, T>::value, "");
 
 public:
-    typedef std::function<bool(T*)> Functor;
-    typedef std::mutex lock_t;
-    lock_t lock_;
-    WaitQueueHook dummy_;
-    WaitQueueHook* head_;
-    WaitQueueHook* tail_;
-    WaitQueueHook* check_;
-    Functor checkFunctor_;
-    WaitQueueHook* pos_;
-    const size_t posDistance_;
-    volatile size_t count_;
-    Functor posFunctor_;
+    typedef LFLock lock_t;
 
     struct CondRet
     {
@@ -36,28 +33,27 @@ public:
         bool needWait;
     };
 
-    explicit WaitQueue(Functor checkFunctor = NULL,
-            size_t posD = -1, Functor const& posFunctor = NULL)
+private:
+    lock_t lock_;
+    WaitQueueHook* head_ = nullptr;
+    WaitQueueHook* tail_ = nullptr;
+    WaitQueueHook* pos_ = nullptr;
+    const size_t posDistance_;
+    volatile size_t count_ = 0;
+
+public:
+    explicit WaitQueue(size_t posD = -1)
         : posDistance_(posD)
     {
-        head_ = &dummy_;
-        tail_ = &dummy_;
-        check_ = &dummy_;
-        checkFunctor_ = checkFunctor;
-        pos_ = nullptr;
-        posFunctor_ = posFunctor;
-        count_ = 0;
     }
 
-    ~WaitQueue() {
-        check_ = pos_ = nullptr;
-        count_ = 0;
-        T* ptr = nullptr;
-        while (pop(ptr))
-            delete ptr;
-    }
+    // 剩余的节点由使用者负责释放
+    ~WaitQueue() {}
+
+    WaitQueue(WaitQueue const&) = delete;
+    WaitQueue& operator=(WaitQueue const&) = delete;
 
-    size_t empty()
+    bool empty()
     {
         return count_ == 0;
     }
@@ -67,77 +63,131 @@ public:
         return count_;
     }
 
-    CondRet push(T* ptr, std::function<CondRet(size_t)> const& cond = NULL)
+    void push(T* ptr)
     {
-        std::unique_lock<lock_t> lock(lock_);
-        CondRet ret{true, true};
-        if (cond) {
-            ret = cond(count_);
-            if (!ret.canQueue)
-                return ret;
-        }
-
-        tail_->next = ptr;
-        ptr->next = nullptr;
-        tail_ = ptr;
-        if (++count_ == posDistance_) {
-            pos_ = ptr;
-        }
-
-        // check
-        if (count_ < (std::max)(posDistance_, posDistance_ + 16)) return ret;
-        if (!checkFunctor_) return ret;
-
-        if (!check_ || !check_->next)
-            check_ = pos_;
+        push([=](size_t) { return ptr; });
+    }
 
-        for (int i = 0; check_ && check_->next && i < 2; ++i) {
-            if (!checkFunctor_(static_cast<T*>(check_->next))) {
-                if (pos_ == check_->next)
-                    pos_ = pos_->next;
+    // 加锁后调用make(当前节点数)得到要插入的节点, 返回nullptr表示不插入
+    template <typename Make>
+    bool push(Make const& make)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        T* ptr = make((size_t)count_);
+        if (!ptr) return false;
+
+        WaitQueueHook* hook = ptr;
+        assert(!hook->owner);
+        hook->owner = this;
+        hook->prev = tail_;
+        hook->next = nullptr;
+        if (tail_) tail_->next = hook;
+        else head_ = hook;
+        tail_ = hook;
+        if (++count_ == posDistance_)
+            pos_ = hook;
+        return true;
+    }
 
-                if (tail_ == check_->next)
-                    tail_ = check_;
+    bool pop(T* & ptr)
+    {
+        return pop(ptr, [](T* pos) { return pos; });
+    }
 
-                auto temp = check_->next;
-                check_->next = check_->next->next;
-                temp->next = nullptr;
-                static_cast<T*>(temp)->DecrementRef();
+    // @onPos: T*(T* pos), 把pos转为不需要等待的节点.
+    //         返回pos表示原地转换, 返回其他节点表示用它替换pos(此后不再访问pos),
+    //         返回nullptr表示转换失败, 尝试下一个.
+    template <typename OnPos>
+    bool pop(T* & ptr, OnPos const& onPos)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        if (!head_) return false;
+
+        WaitQueueHook* hook = head_;
+        bool wasPos = (hook == pos_);
+        unlink(hook);
+        ptr = static_cast<T*>(hook);
+        if (wasPos) return true;
+
+        // 空出了一个位置
+        while (pos_) {
+            // onPos成功后pos的等待者可能已经返回, 之后不能再访问pos
+            WaitQueueHook* prev = pos_->prev;
+            WaitQueueHook* next = pos_->next;
+            T* pos = static_cast<T*>(pos_);
+            T* rep = onPos(pos);
+            if (!rep) {
+                pos_ = next;
                 continue;
             }
 
-            check_ = check_->next;
+            if (rep != pos)
+                replace(prev, next, rep);
+            pos_ = next;
+            break;
         }
-        return ret;
+        return true;
     }
 
-    bool pop(T* & ptr)
+    // 取出第一个满足pred的节点, 不参与pos_的转换(用于多个等待条件共享一个队列的情况)
+    template <typename Pred>
+    bool popIf(T* & ptr, Pred const& pred)
     {
         std::unique_lock<lock_t> lock(lock_);
-        if (head_ == tail_) return false;
-
-        ptr = static_cast<T*>(head_->next);
-        if (tail_ == head_->next) tail_ = head_;
-        if (check_ == head_->next) check_ = check_->next;
-        head_->next = head_->next->next;
-        ptr->next = nullptr;
+        for (WaitQueueHook* hook = head_; hook; hook = hook->next) {
+            if (pred(static_cast<T*>(hook))) {
+                unlink(hook);
+                ptr = static_cast<T*>(hook);
+                return true;
+            }
+        }
+        return false;
+    }
 
-        for (;;) {
-            if (!pos_ || !posFunctor_) break;
+    template <typename Pred>
+    bool anyOf(Pred const& pred)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        for (WaitQueueHook* hook = head_; hook; hook = hook->next)
+            if (pred(static_cast<T*>(hook)))
+                return true;
+        return false;
+    }
 
-            bool ok = posFunctor_(static_cast<T*>(pos_));
-            pos_ = pos_->next;
-            if (ok) break;
-        }
+    // 从队列中摘掉ptr, 不在队列中(已被pop走)时返回false
+    bool erase(T* ptr)
+    {
+        std::unique_lock<lock_t> lock(lock_);
+        WaitQueueHook* hook = ptr;
+        if (hook->owner != this) return false;
+        unlink(hook);
+        return true;
+    }
 
+private:
+    void unlink(WaitQueueHook* hook)
+    {
+        if (pos_ == hook) pos_ = hook->next;
+        if (hook->prev) hook->prev->next = hook->next;
+        else head_ = hook->next;
+        if (hook->next) hook->next->prev = hook->prev;
+        else tail_ = hook->prev;
+        hook->prev = hook->next = nullptr;
+        hook->owner = nullptr;
         --count_;
-        return true;
     }
 
-    bool tryPop(T* & ptr)
+    // 用hook替换prev和next之间的节点, 被替换的节点不再访问
+    void replace(WaitQueueHook* prev, WaitQueueHook* next, WaitQueueHook* hook)
     {
-        if (!count_) return false;
-        return pop(ptr);
+        assert(!hook->owner);
+        hook->prev = prev;
+        hook->next = next;
+        hook->owner = this;
+        if (prev) prev->next = hook;
+        else head_ = hook;
+        if (next) next->prev = hook;
+        else tail_ = hook;
     }
 };
 
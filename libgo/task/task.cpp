@@ -80,7 +80,7 @@ void FCONTEXT_CALL Task::StaticRun(intptr_t vp)
 }
 
 Task::Task(TaskF const& fn, std::size_t stack_size)
-    : ctx_(&Task::StaticRun, (intptr_t)this, stack_size), fn_(fn)
+    : slot_(TaskTable::Alloc(this)), ctx_(&Task::StaticRun, (intptr_t)this, stack_size), fn_(fn)
 {
 //    DebugPrint(dbg_task, "task(%s) construct. this=%p", DebugInfo(), this);
 }
@@ -90,6 +90,7 @@ Task::~Task()
 //    printf("delete Task = %p, impl = %p, weak = %ld\n", this, this->impl_, (long)this->impl_->weak_);
     assert(!this->prev);
     assert(!this->next);
+    TaskTable::Free(slot_);
 //    DebugPrint(dbg_task, "task(%s) destruct. this=%p", DebugInfo(), this);
 }
 
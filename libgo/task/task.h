@@ -4,6 +4,7 @@
 #include "../common/anys.h"
 #include "../context/context.h"
 #include "../debug/debugger.h"
+#include "task_table.h"
 #include <stdio.h>
 
 namespace co
@@ -24,15 +25,17 @@ struct TaskGroupKey {};
 typedef Anys<TaskGroupKey> TaskAnys;
 
 class Processer;
+class TaskGroup;
 
 struct Task
-    : public TSQueueHook, public SharedRefObject, public CoDebugger::DebuggerBase<Task>
+    : public TSQueueHook, public RefObject, public CoDebugger::DebuggerBase<Task>
 {
     // printf("[Task] constructor\n");
 
     TaskState state_ = TaskState::runnable;
     uint64_t id_;
     Processer* proc_ = nullptr;
+    uint32_t slot_;                     // 在TaskTable中的槽位, 挂起序号保存在槽位中
     Context ctx_;
     TaskF fn_;
     std::exception_ptr eptr_;           // 保存exception的指针
@@ -40,7 +43,14 @@ struct Task
 
     uint64_t yieldCount_ = 0;
 
-    atomic_t<uint64_t> suspendId_ {0};
+    // 禁止异步抢占的嵌套层数(见NonPreemptible)
+    uint32_t noPreempt_ = 0;
+
+    // 被唤醒后在Processer的inbound栈中的链接
+    Task* wakeupNext_ = nullptr;
+
+    // 所属的任务组, nullptr表示默认组
+    TaskGroup* group_ = nullptr;
 
     Task(TaskF const& fn, std::size_t stack_size);
     ~Task();
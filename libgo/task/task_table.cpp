@@ -0,0 +1,76 @@
+#include "task_table.h"
+#include "../common/spinlock.h"
+#include <mutex>
+#include <stdexcept>
+
+namespace co
+{
+
+namespace
+{
+
+const uint32_t kNoFreeSlot = (uint32_t)-1;
+
+// 分配和归还只在创建和销毁协程时发生, 用自旋锁保护空闲链表即可
+struct TaskTableState
+{
+    LFLock lock;
+    uint32_t freeHead = kNoFreeSlot;
+    uint32_t size = 0;
+    std::atomic<TaskSlot*> segments[TaskTable::kMaxSegments];
+
+    TaskTableState()
+    {
+        for (auto & seg : segments)
+            seg.store(nullptr, std::memory_order_relaxed);
+    }
+};
+
+TaskTableState & State()
+{
+    // 进程退出时可能还有协程在销毁, 不析构
+    static TaskTableState *state = new TaskTableState;
+    return *state;
+}
+
+} //namespace
+
+std::atomic<TaskSlot*>* TaskTable::Segments()
+{
+    return State().segments;
+}
+
+uint32_t TaskTable::Alloc(Task* tk)
+{
+    TaskTableState & state = State();
+    std::unique_lock<LFLock> lock(state.lock);
+    uint32_t slot = state.freeHead;
+    if (slot != kNoFreeSlot) {
+        TaskSlot & s = Get(slot);
+        state.freeHead = s.nextFree;
+        s.task = tk;
+        return slot;
+    }
+
+    slot = state.size;
+    uint32_t segment = slot >> kSegmentBits;
+    if (segment >= kMaxSegments)
+        throw std::length_error("libgo: too many coroutines for TaskTable");
+    if ((slot & (kSegmentSize - 1)) == 0)
+        state.segments[segment].store(new TaskSlot[kSegmentSize], std::memory_order_release);
+    ++state.size;
+    Get(slot).task = tk;
+    return slot;
+}
+
+void TaskTable::Free(uint32_t slot)
+{
+    TaskTableState & state = State();
+    std::unique_lock<LFLock> lock(state.lock);
+    TaskSlot & s = Get(slot);
+    s.task = nullptr;
+    s.nextFree = state.freeHead;
+    state.freeHead = slot;
+}
+
+} //namespace co
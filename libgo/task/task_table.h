@@ -0,0 +1,88 @@
+#pragma once
+#include "../common/config.h"
+
+namespace co
+{
+
+struct Task;
+
+// 协程槽位
+// 挂起序号放在槽位中而不是协程对象中. 槽位的内存永不释放, 用一个挂起句柄校验或CAS唤醒时,
+// 即使协程已经销毁也不会访问已释放的内存, 所以挂起句柄不需要弱引用.
+struct TaskSlot
+{
+    // 挂起序号, 每次挂起和唤醒各加1. 槽位复用时不清零, 旧协程的句柄在新协程上永远不会生效.
+    atomic_t<uint64_t> suspendId{0};
+
+    // 占用这个槽位的协程, 只在协程挂起期间由CAS唤醒成功者读取
+    Task* task = nullptr;
+
+    uint32_t nextFree = 0;
+};
+
+// 协程槽位表
+// 分段数组, 按需分配段, 段永不释放. 每个存活的协程占一个槽位, 协程销毁时归还.
+// 挂起句柄是64位的(槽位号, 挂起序号), 校验只需一次load.
+class TaskTable
+{
+public:
+    static const int kSlotBits = 26;
+    static const int kSeqBits = 64 - kSlotBits;
+    static const uint64_t kSeqMask = (1ull << kSeqBits) - 1;
+
+    static const int kSegmentBits = 12;
+    static const uint32_t kSegmentSize = 1u << kSegmentBits;
+    static const uint32_t kMaxSegments = 1u << (kSlotBits - kSegmentBits);
+
+    // 分配一个槽位
+    static uint32_t Alloc(Task* tk);
+
+    // 归还槽位
+    static void Free(uint32_t slot);
+
+    ALWAYS_INLINE static TaskSlot& Get(uint32_t slot)
+    {
+        return Segments()[slot >> kSegmentBits].load(std::memory_order_acquire)
+            [slot & (kSegmentSize - 1)];
+    }
+
+    ALWAYS_INLINE static uint64_t MakeHandle(uint32_t slot, uint64_t seq)
+    {
+        return (uint64_t)slot << kSeqBits | (seq & kSeqMask);
+    }
+
+    ALWAYS_INLINE static uint32_t HandleSlot(uint64_t handle)
+    {
+        return (uint32_t)(handle >> kSeqBits);
+    }
+
+    ALWAYS_INLINE static uint64_t HandleSeq(uint64_t handle)
+    {
+        return handle & kSeqMask;
+    }
+
+    // 句柄对应的挂起是否仍然有效
+    ALWAYS_INLINE static bool IsSuspended(uint64_t handle)
+    {
+        uint64_t seq = Get(HandleSlot(handle)).suspendId.load(std::memory_order_acquire);
+        return (seq & kSeqMask) == HandleSeq(handle);
+    }
+
+    // 结束句柄对应的挂起, 同一个句柄只有一个调用者能成功. 成功时返回挂起的协程.
+    ALWAYS_INLINE static Task* TryResume(uint64_t handle)
+    {
+        TaskSlot & slot = Get(HandleSlot(handle));
+        uint64_t seq = slot.suspendId.load(std::memory_order_relaxed);
+        do {
+            if ((seq & kSeqMask) != HandleSeq(handle))
+                return nullptr;
+        } while (!slot.suspendId.compare_exchange_weak(seq, seq + 1,
+                    std::memory_order_acq_rel, std::memory_order_relaxed));
+        return slot.task;
+    }
+
+private:
+    static std::atomic<TaskSlot*>* Segments();
+};
+
+} //namespace co
@@ -30,7 +30,7 @@ void CoTimer::CoTimerImpl::RunInCoroutine()
 
         if (terminate_) break;
 
-        std::unique_lock<LFLock> lock(lock_);
+        std::unique_lock<LFFlag> lock(lock_);
 
         auto nextTime = NextTrigger(precision_);
         auto now = FastSteadyClock::now();
@@ -64,7 +64,7 @@ CoTimer::CoTimerImpl::ExpireAt(FastSteadyClock::duration dur, func_t const& cb)
 
     // 强制唤醒, 提高精准度
     if (dur <= precision_) {
-        std::unique_lock<LFLock> lock(lock_, std::defer_lock);
+        std::unique_lock<LFFlag> lock(lock_, std::defer_lock);
         if (lock.try_lock()) return id;
 
         trigger_.TryPush(nullptr);
@@ -29,7 +29,8 @@ class CoTimer {
         void Stop();
 
     private:
-        LFLock lock_;
+        // 定时器协程等待触发期间持有(会切换协程, 所以不能用LFLock)
+        LFFlag lock_;
 
         // 精度
         FastSteadyClock::duration precision_;
@@ -475,3 +475,572 @@ TEST(Channel, capacity0Timed)
         delete[] p;
     }
 }
+
+TEST(Channel, moveOnly)
+{
+    typedef std::unique_ptr<int> Ptr;
+
+    // capacity = 0, 1, N, std::list, CASChannelImpl
+    std::vector<co_chan<Ptr>> chans;
+    chans.emplace_back(0);
+    chans.emplace_back(1);
+    chans.emplace_back(10);
+    chans.emplace_back(10, 0, 5);
+    chans.emplace_back(1, 16);
+
+    for (auto & ch : chans) {
+        std::atomic<int> total{0};
+        go [=]{
+            for (int i = 1; i <= 100; ++i) {
+                if (i % 2) {
+                    Ptr p(new int(i));
+                    ch << std::move(p);
+                } else {
+                    EXPECT_TRUE(ch.Emplace(new int(i)));
+                }
+            }
+        };
+        go [=, &total]{
+            for (int i = 1; i <= 100; ++i) {
+                Ptr p;
+                ch >> p;
+                EXPECT_TRUE(!!p);
+                if (p) total += *p;
+            }
+        };
+        WaitUntilNoTask();
+        EXPECT_EQ(total, 5050);
+        EXPECT_TRUE(ch.empty());
+    }
+
+    // 失败的TryPush不会move走数据
+    co_chan<Ptr> ch(1);
+    Ptr p(new int(1));
+    EXPECT_TRUE(ch.TryPush(std::move(p)));
+    p.reset(new int(2));
+    EXPECT_FALSE(ch.TryPush(std::move(p)));
+    EXPECT_TRUE(!!p);
+    EXPECT_TRUE(ch.TryPop(p));
+    EXPECT_EQ(*p, 1);
+}
+
+TEST(Channel, batch)
+{
+    // capacity = 0, 1, N, std::list, CASChannelImpl, SegmentedChannelImpl(有界/无界)
+    std::vector<co_chan<int>> chans;
+    chans.emplace_back(0);
+    chans.emplace_back(1);
+    chans.emplace_back(100);
+    chans.emplace_back(100, 0, 5);
+    chans.emplace_back(10, 16);
+    chans.emplace_back(100, 0, 1);
+    chans.emplace_back((std::size_t)-1);
+
+    const int kCount = 10000;
+    for (auto & ch : chans) {
+        std::atomic<long> total{0};
+        go [=]{
+            std::vector<int> values;
+            for (int i = 1; i <= kCount; ++i) {
+                values.push_back(i);
+                if (values.size() == 64 || i == kCount) {
+                    EXPECT_EQ(ch.PushN(values), values.size());
+                    values.clear();
+                }
+            }
+        };
+        go [=, &total]{
+            std::vector<int> out;
+            while (out.size() < (std::size_t)kCount) {
+                std::size_t n = ch.PopN(out, 50);
+                EXPECT_GT(n, 0u);
+                EXPECT_LE(n, 50u);
+            }
+            for (int i = 0; i < kCount; ++i) {
+                EXPECT_EQ(out[i], i + 1);
+            }
+            for (int v : out) total += v;
+        };
+        WaitUntilNoTask();
+        EXPECT_EQ(total, (long)kCount * (kCount + 1) / 2);
+        EXPECT_TRUE(ch.empty());
+    }
+
+    // 缓冲区只能写入一部分
+    co_chan<int> ch(3);
+    int values[5] = {1, 2, 3, 4, 5};
+    EXPECT_EQ(ch.TryPushN(values, 5), 3u);
+    int out[5] = {};
+    EXPECT_EQ(ch.TryPopN(out, 5), 3u);
+    EXPECT_EQ(out[0], 1);
+    EXPECT_EQ(out[2], 3);
+    EXPECT_EQ(ch.TryPopN(out, 5), 0u);
+
+    // 超时
+    GTimer t;
+    EXPECT_EQ(ch.TimedPopN(out, 5, milliseconds(50)), 0u);
+    TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+    // 等待中的写者在读取之后被批量写入
+    go [=]{
+        int more[6] = {1, 2, 3, 4, 5, 6};
+        EXPECT_EQ(ch.PushN(more, 6), 6u);
+    };
+    std::vector<int> vout;
+    while (vout.size() < 6)
+        ch.PopN(vout, 6);
+    EXPECT_EQ(vout.size(), 6u);
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(vout[i], i + 1);
+    }
+    WaitUntilNoTask();
+}
+
+// 超时与唤醒同时发生时, 数据既不能丢失也不能凭空多出
+TEST(Channel, timedRace)
+{
+    for (std::size_t choose1 : {0, 100}) {
+        for (std::size_t capacity : {0, 4}) {
+            co_chan<long> ch(capacity, choose1);
+            const int kCount = 2000;
+            std::atomic<long> pushed{0}, popped{0};
+            for (int w = 0; w < 4; ++w)
+                go [=, &pushed]{
+                    for (int i = 1; i <= kCount; ++i)
+                        if (ch.TimedPush(i, microseconds(50 * (i % 7))))
+                            pushed += i;
+                };
+            for (int r = 0; r < 4; ++r)
+                go [=, &popped]{
+                    for (int i = 1; i <= kCount; ++i) {
+                        long v = 0;
+                        if (ch.TimedPop(v, microseconds(50 * (i % 5))))
+                            popped += v;
+                    }
+                };
+            WaitUntilNoTask();
+            long v = 0;
+            while (ch.TryPop(v))
+                popped += v;
+            EXPECT_EQ(pushed, popped);
+        }
+    }
+}
+
+// 同一个Processer上的ping-pong, 统计期间其他协程被调度的次数
+static int pingPong(Scheduler & sched, bool handoff, int rounds)
+{
+    co_chan<int> req, rsp;
+    req.SetHandoff(handoff);
+    rsp.SetHandoff(handoff);
+
+    std::atomic<bool> done{false};
+    std::atomic<int> others{0};
+    std::atomic<int> errors{0};
+    for (int i = 0; i < 4; ++i) {
+        go co_scheduler(sched) [&]{
+            while (!done) {
+                ++others;
+                co_yield;
+            }
+        };
+    }
+    go co_scheduler(sched) [&]{
+        for (int i = 0; i < rounds; ++i) {
+            int v = -1;
+            req << i;
+            rsp >> v;
+            if (v != i + 1) ++errors;
+        }
+        done = true;
+    };
+    go co_scheduler(sched) [&]{
+        for (int i = 0; i < rounds; ++i) {
+            int v = -1;
+            req >> v;
+            rsp << v + 1;
+        }
+    };
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(errors, 0);
+    return others;
+}
+
+TEST(Channel, destroyInCoroutine)
+{
+    // 在协程中析构Channel, 不能让所在线程一直禁止抢占
+    std::atomic<int> nonZero{0};
+    for (int i = 0; i < 10; ++i)
+        go [&]{
+            {
+                co_chan<int> ch(1);
+                ch << 1;
+                ch >> nullptr;
+            }
+            if (PreemptOffDepth() != 0) ++nonZero;
+        };
+    WaitUntilNoTask();
+    EXPECT_EQ(nonZero, 0);
+}
+
+TEST(Channel, handoff)
+{
+    // 只有一个Processer, 保证读写双方在同一个线程上
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 1); }).detach();
+
+    // 与不使用run-next的唤醒比较
+    const int kRounds = 2000;
+    co_opt.wakeup_run_next = false;
+    int normal = pingPong(*sched, false, kRounds);
+    co_opt.wakeup_run_next = true;
+    int handoff = pingPong(*sched, true, kRounds);
+    EXPECT_LT(handoff, normal);
+    EXPECT_LT(handoff, kRounds);
+}
+
+TEST(Channel, handoffLongRun)
+{
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 1); }).detach();
+
+    // ping每一轮都唤醒一次旁观的协程, 交接时ping-pong双方总是插在它前面.
+    // 交接上限用完一次以后交接还要能继续, 否则后一半里旁观者每一轮都会执行.
+    const int kRounds = 20000;
+    co_chan<int> req, rsp, w(1);
+    req.SetHandoff(true);
+    rsp.SetHandoff(true);
+    w.SetHandoff(true);
+    std::atomic<int> others{0};
+    int half = 0;
+
+    // 由一个协程统一创建, 保证三个协程按顺序进入runnable队列
+    go co_scheduler(*sched) [&]{
+        go co_scheduler(*sched) [&]{
+            for (int i = 0; i < kRounds; ++i) {
+                if (i == kRounds / 2)
+                    half = others;
+                int v = -1;
+                req << i;
+                w.TryPush(i);
+                rsp >> v;
+            }
+            w << -1;
+        };
+        go co_scheduler(*sched) [&]{
+            for (int i = 0; i < kRounds; ++i) {
+                int v = -1;
+                req >> v;
+                rsp << v + 1;
+            }
+        };
+        go co_scheduler(*sched) [&]{
+            for (;;) {
+                int v = -1;
+                w >> v;
+                if (v < 0) break;
+                ++others;
+            }
+        };
+    };
+    WaitUntilNoTaskS(*sched);
+
+    // 后一半里交接仍在进行, 旁观者只在交接上限用完时得到执行
+    EXPECT_GT(others - half, 0);
+    EXPECT_LT(others - half, kRounds / 2 / 4);
+}
+
+TEST(Channel, spsc)
+{
+    const int kCount = 20000;
+    for (std::size_t capacity : {1, 2, 7, 1024}) {
+        co_chan<int> ch(capacity, co::spsc);
+        std::atomic<int> errors{0};
+        go [=]{
+            for (int i = 0; i < kCount; ++i)
+                ch << i;
+        };
+        go [=, &errors]{
+            for (int i = 0; i < kCount; ++i) {
+                int v = -1;
+                ch >> v;
+                if (v != i) ++errors;
+            }
+        };
+        WaitUntilNoTask();
+        EXPECT_EQ(errors, 0);
+        EXPECT_TRUE(ch.empty());
+    }
+
+    // 原生线程写, 协程批量读
+    {
+        co_chan<int> ch(64, co::spsc);
+        std::atomic<int> errors{0};
+        std::thread producer([=]{
+                std::vector<int> values;
+                for (int i = 0; i < kCount; ++i) {
+                    values.push_back(i);
+                    if (values.size() == 100) {
+                        ch.PushN(values);
+                        values.clear();
+                    }
+                }
+            });
+        go [=, &errors]{
+            std::vector<int> out;
+            while (out.size() < (std::size_t)kCount)
+                ch.PopN(out, 128);
+            for (int i = 0; i < kCount; ++i)
+                if (out[i] != i) ++errors;
+        };
+        producer.join();
+        WaitUntilNoTask();
+        EXPECT_EQ(errors, 0);
+    }
+
+    // Try/Timed/Close
+    {
+        co_chan<int> ch(2, co::spsc);
+        EXPECT_TRUE(ch.TryPush(1));
+        EXPECT_TRUE(ch.TryPush(2));
+        EXPECT_FALSE(ch.TryPush(3));
+        EXPECT_EQ(ch.size(), 2u);
+
+        GTimer t;
+        EXPECT_FALSE(ch.TimedPush(3, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+        int v = 0;
+        EXPECT_TRUE(ch.TryPop(v));
+        EXPECT_EQ(v, 1);
+        EXPECT_TRUE(ch.TryPop(v));
+        EXPECT_EQ(v, 2);
+        EXPECT_FALSE(ch.TryPop(v));
+
+        t.reset();
+        EXPECT_FALSE(ch.TimedPop(v, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+        go [=]{
+            int x = 0;
+            EXPECT_FALSE(ch.TimedPop(x, seconds(10)));
+        };
+        usleep(20 * 1000);
+        ch.Close();
+        WaitUntilNoTask();
+        EXPECT_FALSE(ch.TryPush(1));
+    }
+}
+
+TEST(Channel, segmented)
+{
+    // 无界, 多读多写, 跨越多个Segment
+    {
+        co_chan<int> ch((std::size_t)-1);
+        const int kWriters = 4, kReaders = 4, kCount = 50000;
+        std::atomic<long> total{0};
+        std::atomic<int> received{0};
+        for (int w = 0; w < kWriters; ++w)
+            go [=]{
+                for (int i = 1; i <= kCount; ++i)
+                    ch << i;
+            };
+        for (int r = 0; r < kReaders; ++r)
+            go [=, &total, &received]{
+                int v;
+                while (ch.TimedPop(v, milliseconds(200))) {
+                    total += v;
+                    ++received;
+                }
+            };
+        WaitUntilNoTask();
+        EXPECT_EQ(received, kWriters * kCount);
+        EXPECT_EQ(total, (long)kWriters * kCount * (kCount + 1) / 2);
+        EXPECT_TRUE(ch.empty());
+    }
+
+    // 先写入大量数据再读出, 保持FIFO
+    {
+        co_chan<std::string> ch(1 << 20, 0, 1);
+        for (int i = 0; i < 10000; ++i) {
+            EXPECT_TRUE(ch.TryPush(std::to_string(i)));
+        }
+        EXPECT_EQ(ch.size(), 10000u);
+        std::string s;
+        for (int i = 0; i < 10000; ++i) {
+            EXPECT_TRUE(ch.TryPop(s));
+            EXPECT_EQ(s, std::to_string(i));
+        }
+        EXPECT_FALSE(ch.TryPop(s));
+    }
+
+    // 有界: 写满后等待
+    {
+        co_chan<int> ch(3, 0, 1);
+        EXPECT_TRUE(ch.TryPush(1));
+        EXPECT_TRUE(ch.TryPush(2));
+        EXPECT_TRUE(ch.TryPush(3));
+        EXPECT_FALSE(ch.TryPush(4));
+
+        GTimer t;
+        EXPECT_FALSE(ch.TimedPush(4, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+        go [=]{ ch << 4; };
+        int v = 0;
+        for (int i = 1; i <= 4; ++i) {
+            ch >> v;
+            EXPECT_EQ(v, i);
+        }
+        WaitUntilNoTask();
+        EXPECT_TRUE(ch.empty());
+
+        go [=]{
+            int x;
+            EXPECT_FALSE(ch.TimedPop(x, seconds(10)));
+        };
+        usleep(20 * 1000);
+        ch.Close();
+        WaitUntilNoTask();
+    }
+
+    // 批量: 写满时只写入一部分; 一次写入唤醒多个等待的读者
+    {
+        co_chan<int> ch(3, 0, 1);
+        int values[5] = {1, 2, 3, 4, 5};
+        EXPECT_EQ(ch.TryPushN(values, 5), 3u);
+        int out[5] = {};
+        EXPECT_EQ(ch.TryPopN(out, 5), 3u);
+        EXPECT_EQ(out[0], 1);
+        EXPECT_EQ(out[2], 3);
+        EXPECT_EQ(ch.TryPopN(out, 5), 0u);
+
+        std::atomic<int> received{0};
+        for (int i = 0; i < 3; ++i)
+            go [=, &received]{
+                int v;
+                if (ch.TimedPop(v, seconds(10))) ++received;
+            };
+        usleep(20 * 1000);
+        EXPECT_EQ(ch.PushN(values, 3), 3u);
+        WaitUntilNoTask();
+        EXPECT_EQ(received, 3);
+    }
+}
+
+TEST(BroadcastChannel, block)
+{
+    const int kSubscribers = 4, kCount = 10000;
+    co::BroadcastChannel<int> ch(16);
+    std::atomic<int> errors{0};
+    std::atomic<long> total{0};
+    std::vector<co::BroadcastChannel<int>::Subscriber> subs;
+    for (int i = 0; i < kSubscribers; ++i)
+        subs.push_back(ch.Subscribe());
+    EXPECT_EQ(ch.SubscriberCount(), (std::size_t)kSubscribers);
+
+    for (auto & sub : subs) {
+        auto *pSub = &sub;
+        go [=, &errors, &total]{
+            int v, expect = 0;
+            while (pSub->Pop(v)) {
+                if (v != expect++) ++errors;
+                total += v;
+            }
+            if (expect != kCount) ++errors;
+        };
+    }
+    go [=]{
+        for (int i = 0; i < kCount; ++i)
+            ch << i;
+        ch.Close();
+    };
+    WaitUntilNoTask();
+    EXPECT_EQ(errors, 0);
+    EXPECT_EQ(total, (long)kSubscribers * kCount * (kCount - 1) / 2);
+
+    // 关闭后不能再发布
+    EXPECT_FALSE(ch.TryPublish(1));
+    subs.clear();
+    EXPECT_EQ(ch.SubscriberCount(), 0u);
+}
+
+TEST(BroadcastChannel, lagPolicy)
+{
+    // block: 写满时TryPublish失败, 超时发布失败
+    {
+        co::BroadcastChannel<int> ch(2);
+        auto sub = ch.Subscribe();
+        EXPECT_TRUE(ch.TryPublish(1));
+        EXPECT_TRUE(ch.TryPublish(2));
+        EXPECT_FALSE(ch.TryPublish(3));
+        GTimer t;
+        EXPECT_FALSE(ch.TimedPublish(3, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+        int v = 0;
+        EXPECT_TRUE(sub.TryPop(v));
+        EXPECT_EQ(v, 1);
+        EXPECT_TRUE(ch.TryPublish(3));
+
+        // 退订后不再阻塞发布者
+        sub.Unsubscribe();
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(ch.TryPublish(i));
+        }
+    }
+
+    // drop_oldest: 慢的订阅者跳过被覆盖的消息
+    {
+        co::BroadcastChannel<int> ch(4, co::lag_policy::drop_oldest);
+        auto sub = ch.Subscribe();
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(ch.TryPublish(i));
+        }
+        int v = 0;
+        for (int i = 6; i < 10; ++i) {
+            EXPECT_TRUE(sub.TryPop(v));
+            EXPECT_EQ(v, i);
+        }
+        EXPECT_FALSE(sub.TryPop(v));
+        EXPECT_EQ(sub.Dropped(), 6u);
+    }
+
+    // disconnect: 慢的订阅者被断开, 不影响其他订阅者
+    {
+        co::BroadcastChannel<int> ch(4, co::lag_policy::disconnect);
+        auto slow = ch.Subscribe();
+        auto fast = ch.Subscribe();
+        int v = 0;
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(ch.TryPublish(i));
+            EXPECT_TRUE(fast.TryPop(v));
+            EXPECT_EQ(v, i);
+        }
+        EXPECT_TRUE(slow.Disconnected());
+        EXPECT_FALSE(fast.Disconnected());
+        EXPECT_FALSE(slow.TryPop(v));
+        EXPECT_EQ(ch.SubscriberCount(), 1u);
+    }
+}
+
+TEST(BroadcastChannel, zeroCopy)
+{
+    typedef std::unique_ptr<int> Ptr;
+    co::BroadcastChannel<Ptr> ch(8);
+    auto sub1 = ch.Subscribe();
+    auto sub2 = ch.Subscribe();
+    int* raw = new int(42);
+    EXPECT_TRUE(ch.Publish(Ptr(raw)));
+
+    const int* seen1 = nullptr;
+    const int* seen2 = nullptr;
+    EXPECT_TRUE(sub1.TryVisit([&](Ptr const& p){ seen1 = p.get(); }));
+    EXPECT_TRUE(sub2.TryVisit([&](Ptr const& p){ seen2 = p.get(); }));
+    EXPECT_EQ(seen1, raw);
+    EXPECT_EQ(seen2, raw);
+
+    GTimer t;
+    EXPECT_FALSE(sub1.TimedVisit([&](Ptr const&){}, milliseconds(50)));
+    TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+}
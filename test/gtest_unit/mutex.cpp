@@ -1,5 +1,6 @@
 #include <iostream>
 #include <unistd.h>
+#include <queue>
 #include <gtest/gtest.h>
 #include "coroutine.h"
 #include <boost/thread.hpp>
@@ -136,3 +137,269 @@ TEST(Mutex, test_rwmutex)
     EXPECT_EQ(*v1, 10000);
     EXPECT_EQ(*v2, 10000);
 }
+
+TEST(Mutex, footprint)
+{
+    EXPECT_LE(sizeof(co_mutex), sizeof(void*));
+    EXPECT_LE(sizeof(co_rwmutex), sizeof(void*));
+    EXPECT_LE(sizeof(co_condition_variable), sizeof(void*));
+
+    // 同一个桶内的不同地址互不干扰
+    std::vector<co_mutex> mutexes(4096);
+    std::atomic<int> total{0};
+    for (int i = 0; i < 64; ++i)
+        go [&, i]{
+            for (int j = 0; j < 1000; ++j) {
+                std::unique_lock<co_mutex> lock(mutexes[(i * 7 + j) % mutexes.size()]);
+                ++total;
+            }
+        };
+    WaitUntilNoTask();
+    EXPECT_EQ(total, 64 * 1000);
+}
+
+TEST(Mutex, condition_variable)
+{
+    co_mutex m;
+    co_condition_variable cv;
+    std::queue<int> q;
+    bool done = false;
+    long sum = 0;
+
+    // 协程和原生线程都可以等待
+    std::thread consumer([&]{
+            std::unique_lock<co_mutex> lock(m);
+            for (;;) {
+                cv.wait(lock, [&]{ return !q.empty() || done; });
+                if (q.empty()) break;
+                sum += q.front();
+                q.pop();
+            }
+        });
+    for (int i = 0; i < 10; ++i)
+        go [&, i]{
+            for (int j = 1; j <= 100; ++j) {
+                std::unique_lock<co_mutex> lock(m);
+                q.push(j);
+                cv.notify_one();
+            }
+        };
+    WaitUntilNoTask();
+    {
+        std::unique_lock<co_mutex> lock(m);
+        done = true;
+        cv.notify_all();
+    }
+    consumer.join();
+    EXPECT_EQ(sum, 10 * 5050);
+
+    // 超时
+    go [&]{
+        std::unique_lock<co_mutex> lock(m);
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_TRUE(cv.wait_for(lock, std::chrono::milliseconds(50)) == std::cv_status::timeout);
+        EXPECT_TRUE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(45));
+        EXPECT_TRUE(m.is_lock());
+    };
+    WaitUntilNoTask();
+}
+
+// 有竞争时的加锁性能: 每个Processer上若干协程反复加锁, 临界区很短
+TEST(Mutex, benchmark)
+{
+    const int kTasks = 64;
+    const int kLoop = 20000;
+    for (int nProc : {1, 4, 16, 64}) {
+        Scheduler *sched = Scheduler::Create();
+        std::thread([=]{ sched->Start(nProc, nProc); }).detach();
+
+        co_mutex m;
+        long counter = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kTasks; ++i) {
+            go co_scheduler(sched) [&]{
+                for (int j = 0; j < kLoop; ++j) {
+                    std::unique_lock<co_mutex> lock(m);
+                    ++counter;
+                }
+            };
+        }
+        WaitUntilNoTaskS(*sched);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(counter, (long)kTasks * kLoop);
+        printf("co_mutex %2d processers, %d tasks x %d lock: %8ld us, %6.1f ns/op\n",
+                nProc, kTasks, kLoop, (long)us, us * 1000.0 / (kTasks * kLoop));
+    }
+}
+
+// 饥饿模式: 持有者释放后立即重新加锁, 等待者也要能在有限时间内拿到锁
+TEST(Mutex, fairness)
+{
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(2, 2); }).detach();
+
+    co_mutex m;
+    std::atomic<bool> done{false};
+    std::atomic<int> acquired{0};
+    go co_scheduler(sched) [&]{
+        while (!done) {
+            std::unique_lock<co_mutex> lock(m);
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(100);
+            while (std::chrono::steady_clock::now() < until) ;
+        }
+    };
+    go co_scheduler(sched) [&]{
+        for (int i = 0; i < 10; ++i) {
+            usleep(100);
+            std::unique_lock<co_mutex> lock(m);
+            ++acquired;
+        }
+        done = true;
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done && std::chrono::steady_clock::now() < deadline)
+        usleep(1000);
+    EXPECT_TRUE(done);
+    EXPECT_EQ(acquired, 10);
+    done = true;
+    WaitUntilNoTaskS(*sched);
+}
+
+// 读偏向模式: 语义与普通读写锁相同
+TEST(Mutex, rwmutex_reader_bias)
+{
+    co_rwmutex m(true, true);
+
+    go [&]{
+        // 同一个协程的多个读锁
+        EXPECT_TRUE(m.reader().try_lock());
+        m.reader().lock();
+        EXPECT_FALSE(m.writer().try_lock());
+        m.reader().unlock();
+        EXPECT_FALSE(m.writer().try_lock());
+        m.reader().unlock();
+
+        EXPECT_TRUE(m.writer().try_lock());
+        EXPECT_TRUE(m.writer().is_lock());
+        EXPECT_FALSE(m.reader().try_lock());
+        m.writer().unlock();
+        EXPECT_FALSE(m.writer().is_lock());
+    };
+    WaitUntilNoTask();
+
+    // 原生线程持有读锁时, 写者等待读者退出
+    {
+        std::atomic<bool> locked{false}, release{false};
+        std::thread reader([&]{
+            std::unique_lock<co_rmutex> lock(m.reader());
+            locked = true;
+            while (!release) usleep(100);
+        });
+        while (!locked) usleep(100);
+        EXPECT_FALSE(m.writer().try_lock());
+        release = true;
+        m.writer().lock();
+        m.writer().unlock();
+        reader.join();
+    }
+
+    // 读多写少: 读者看到的总是一致的数据
+    for (bool readerBias : {false, true}) {
+        co_rwmutex rw(true, readerBias);
+        long *a = new long(0), *b = new long(0);
+        std::atomic<int> errors{0};
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 16; ++i)
+            go [&]{
+                for (int j = 0; j < 20000; ++j) {
+                    std::unique_lock<co_rmutex> lock(rw.reader());
+                    if (*a != *b) ++errors;
+                    if (j % 1000 == 0) co_yield;
+                }
+            };
+        for (int i = 0; i < 2; ++i)
+            go [&]{
+                for (int j = 0; j < 100; ++j) {
+                    {
+                        std::unique_lock<co_wmutex> lock(rw.writer());
+                        ++*a;
+                        co_yield;
+                        ++*b;
+                    }
+                    co_yield;
+                }
+            };
+        WaitUntilNoTask();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(errors, 0);
+        EXPECT_EQ(*a, 200);
+        EXPECT_EQ(*b, 200);
+        printf("co_rwmutex readerBias=%d: %8ld us\n", (int)readerBias, (long)us);
+        delete a;
+        delete b;
+    }
+}
+
+TEST(Mutex, seqlock)
+{
+    struct Quote
+    {
+        long bid;
+        long ask;
+        long volume;
+    };
+
+    co_seqlock<Quote> quote(Quote{0, 1, 0});
+    EXPECT_EQ(quote.Load().ask, 1);
+    EXPECT_EQ(quote.Version(), 0u);
+
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::atomic<long> reads{0};
+    for (int i = 0; i < 16; ++i)
+        go [&]{
+            while (!done) {
+                Quote q = quote.Load();
+                if (q.ask != q.bid + 1 || q.volume != q.bid * 10) ++errors;
+                ++reads;
+                if (reads % 100 == 0) co_yield;
+            }
+        };
+
+    // 原生线程中的读者
+    std::thread native([&]{
+        while (!done) {
+            Quote q = quote.Load();
+            if (q.ask != q.bid + 1 || q.volume != q.bid * 10) ++errors;
+        }
+    });
+
+    // 多个写者互斥地读-改-写
+    const int kWriters = 4, kWrites = 2000;
+    std::atomic<int> writers{kWriters};
+    for (int i = 0; i < kWriters; ++i)
+        go [&]{
+            for (int j = 0; j < kWrites; ++j) {
+                quote.Update([](Quote & q) {
+                    ++q.bid;
+                    q.ask = q.bid + 1;
+                    q.volume = q.bid * 10;
+                });
+                if (j % 10 == 0) co_yield;
+            }
+            if (--writers == 0) done = true;
+        };
+    WaitUntilNoTask();
+    native.join();
+
+    EXPECT_EQ(errors, 0);
+    EXPECT_GT(reads, 0);
+    EXPECT_EQ(quote.Load().bid, kWriters * kWrites);
+    EXPECT_EQ(quote.Version(), (uint32_t)(kWriters * kWrites));
+
+    quote.Store(Quote{7, 8, 70});
+    EXPECT_EQ(quote.Load().volume, 70);
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "coroutine.h"
+#include <boost/thread.hpp>
+#include "gtest_exit.h"
+using namespace std;
+using namespace co;
+
+struct RouteTable
+{
+    long a, b;
+
+    RouteTable(long v) : a(v), b(v) {}
+
+    // 释放后再被读到就能发现
+    ~RouteTable() { a = -1; b = -2; }
+};
+
+TEST(Rcu, readers_and_writers)
+{
+    RcuPtr<RouteTable> table(new RouteTable(0));
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::atomic<long> reads{0};
+
+    // 协程中的读者
+    for (int i = 0; i < 16; ++i)
+        go [&]{
+            while (!done) {
+                {
+                    co_rcu_read_lock guard;
+                    RouteTable* t = table.get();
+                    if (t->a != t->b || t->a < 0) ++errors;
+                    ++reads;
+                }
+                co_yield;
+            }
+        };
+
+    // 原生线程中的读者
+    std::thread native([&]{
+        while (!done) {
+            co_rcu_read_lock guard;
+            RouteTable* t = table.get();
+            if (t->a != t->b || t->a < 0) ++errors;
+            ++reads;
+        }
+    });
+
+    // 写者: 一半用call_rcu释放, 一半同步等待宽限期后释放
+    go [&]{
+        for (long v = 1; v <= 200; ++v) {
+            if (v % 2) {
+                table.reset(new RouteTable(v));
+            } else {
+                RouteTable* old = table.exchange(new RouteTable(v));
+                synchronize_rcu();
+                delete old;
+            }
+            co_sleep(1);
+        }
+        done = true;
+    };
+    WaitUntilNoTask();
+    native.join();
+
+    EXPECT_EQ(errors, 0);
+    EXPECT_GT(reads, 0);
+    EXPECT_EQ(table.get()->a, 200);
+}
+
+TEST(Rcu, synchronize_waits_for_readers)
+{
+    std::atomic<bool> entered{false}, exited{false};
+    std::thread reader([&]{
+        co_rcu_read_lock guard;
+        entered = true;
+        usleep(50 * 1000);
+        exited = true;
+    });
+    while (!entered) usleep(100);
+
+    synchronize_rcu();
+    EXPECT_TRUE(exited);
+    reader.join();
+
+    // 协程中调用不阻塞调度线程
+    std::atomic<int> n{0};
+    for (int i = 0; i < 8; ++i)
+        go [&]{
+            synchronize_rcu();
+            ++n;
+        };
+    WaitUntilNoTask();
+    EXPECT_EQ(n, 8);
+}
+
+TEST(Rcu, call_rcu)
+{
+    std::atomic<int> called{0};
+    for (int i = 0; i < 100; ++i)
+        call_rcu([&]{ ++called; });
+
+    for (int i = 0; i < 5000 && called < 100; ++i)
+        usleep(1000);
+    EXPECT_EQ(called, 100);
+}
@@ -1,12 +1,21 @@
 #include <iostream>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <set>
 #include <gtest/gtest.h>
 #include "coroutine.h"
+#include "scheduler/cpu_topology.h"
 #include <boost/thread.hpp>
 #include "gtest_exit.h"
 using namespace std;
 using namespace co;
 
+// 不经过hook, 真正阻塞当前线程
+static void BlockingSleep(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    syscall(SYS_nanosleep, &ts, nullptr);
+}
+
 Scheduler & sched2() {
     static Scheduler *obj = Scheduler::Create();
     return *obj;
@@ -26,3 +35,632 @@ TEST(MultiScheduler, multiScheduler)
     WaitUntilNoTaskS(sched);
     EXPECT_EQ(val, 1);
 }
+
+TEST(Scheduler, wakeupBatch)
+{
+    const int kTasks = 200;
+    std::mutex mtx;
+    std::vector<Processer::SuspendEntry> entries;
+    std::atomic<int> woken{0};
+    for (int i = 0; i < kTasks; ++i)
+        go [&]{
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                entries.push_back(Processer::Suspend());
+            }
+            Processer::StaticCoYield();
+            ++woken;
+        };
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if ((int)entries.size() == kTasks) break;
+        lock.unlock();
+        usleep(1000);
+    }
+
+    {
+        WakeupBatch batch;
+        EXPECT_TRUE(WakeupBatch::Current() == &batch);
+        for (auto & entry : entries) {
+            EXPECT_TRUE(Processer::Wakeup(entry));
+        }
+
+        // 同一个entry重复唤醒, 只有第一次生效
+        EXPECT_TRUE(Processer::Wakeup(entries[0]));
+        EXPECT_EQ(woken, 0);
+        EXPECT_EQ(batch.Commit(), (std::size_t)kTasks);
+    }
+    EXPECT_TRUE(WakeupBatch::Current() == nullptr);
+
+    WaitUntilNoTask();
+    EXPECT_EQ(woken, kTasks);
+
+    // 已唤醒的entry失效
+    for (auto & entry : entries) {
+        EXPECT_FALSE(Processer::Wakeup(entry));
+    }
+}
+
+TEST(Scheduler, concurrentWakeup)
+{
+    // 多个原生线程同时唤醒同一批协程, 每个挂起标识只有一次唤醒生效
+    const int kTasks = 100;
+    const int kRounds = 20;
+    const int kWakers = 4;
+    std::mutex mtx;
+    std::vector<Processer::SuspendEntry> entries;
+    std::atomic<int> resumed{0};
+    for (int i = 0; i < kTasks; ++i)
+        go [&]{
+            for (int r = 0; r < kRounds; ++r) {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    entries.push_back(Processer::Suspend());
+                }
+                Processer::StaticCoYield();
+                ++resumed;
+            }
+        };
+
+    std::atomic<int> succeeded{0};
+    for (int r = 0; r < kRounds; ++r) {
+        std::vector<Processer::SuspendEntry> round;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mtx);
+            if ((int)entries.size() == kTasks) {
+                round.swap(entries);
+                break;
+            }
+            lock.unlock();
+            usleep(100);
+        }
+
+        std::vector<std::thread> wakers;
+        for (int w = 0; w < kWakers; ++w)
+            wakers.emplace_back([&, w]{
+                for (int i = 0; i < kTasks; ++i) {
+                    auto & entry = round[(i + w * kTasks / kWakers) % kTasks];
+                    if (Processer::Wakeup(entry))
+                        ++succeeded;
+                }
+            });
+        for (auto & t : wakers)
+            t.join();
+    }
+
+    WaitUntilNoTask();
+    EXPECT_EQ(succeeded, kTasks * kRounds);
+    EXPECT_EQ(resumed, kTasks * kRounds);
+}
+
+TEST(Scheduler, suspendHandle)
+{
+    // 挂起标识是64位的(槽位号, 挂起序号), 不持有协程
+    static_assert(sizeof(Processer::SuspendEntry) == sizeof(uint64_t), "SuspendEntry should be one word");
+    EXPECT_FALSE(Processer::SuspendEntry());
+    EXPECT_TRUE(Processer::IsExpire(Processer::SuspendEntry()));
+
+    Processer::SuspendEntry entry;
+    go [&]{
+        entry = Processer::Suspend();
+        EXPECT_FALSE(entry.IsExpire());
+        Processer::StaticCoYield();
+    };
+    while (!entry) usleep(1000);
+    EXPECT_FALSE(entry.IsExpire());
+    EXPECT_TRUE(Processer::Wakeup(entry));
+    EXPECT_TRUE(entry.IsExpire());
+    WaitUntilNoTask();
+
+    // 协程销毁后槽位被复用, 旧的挂起标识仍然无效
+    std::atomic<int> n{0};
+    for (int i = 0; i < 100; ++i)
+        go [&]{
+            Processer::Suspend(std::chrono::milliseconds(1));
+            Processer::StaticCoYield();
+            ++n;
+        };
+    EXPECT_TRUE(entry.IsExpire());
+    EXPECT_FALSE(Processer::Wakeup(entry));
+    WaitUntilNoTask();
+    EXPECT_EQ(n, 100);
+}
+
+TEST(Scheduler, blockingRegion)
+{
+    // 不在协程中什么也不做
+    {
+        co_blocking_region region;
+        EXPECT_FALSE(region.IsHandedOff());
+    }
+
+    // 阻塞期间, 同一调度线程上排队的协程立即由其他调度线程执行, 不必等待cycle_timeout_us
+    const int kTasks = 20;
+    std::atomic<int> done{0};
+    std::atomic<bool> handedOff{false};
+    std::atomic<int> doneInRegion{-1};
+    std::atomic<long> waitMs{0};
+    go [&]{
+        for (int i = 0; i < kTasks; ++i)
+            go [&]{ ++done; };
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            co_blocking_region region;
+            handedOff = region.IsHandedOff();
+
+            // 不经过hook的阻塞调用
+            while (done < kTasks &&
+                    std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500))
+                std::this_thread::yield();
+            doneInRegion = (int)done;
+            waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            // 嵌套时什么也不做
+            co_blocking_region inner;
+            EXPECT_FALSE(inner.IsHandedOff());
+        }
+    };
+    WaitUntilNoTask();
+    EXPECT_TRUE(handedOff);
+    EXPECT_EQ(doneInRegion, kTasks);
+    EXPECT_LT(waitMs, (long)CoroutineOptions::getInstance().cycle_timeout_us / 1000);
+}
+
+TEST(Scheduler, blockingRegionSuspend)
+{
+    // 区域内挂起: 区域随即结束, 协程可能在别的调度线程上恢复, 退出区域时不能影响那个线程
+    const int kTasks = 8;
+    const int kRounds = 20;
+    std::atomic<int> done{0};
+    std::atomic<int> handedOff{0};
+    std::atomic<int> reentered{0};
+    co_chan<int> ch;
+    for (int i = 0; i < kTasks; ++i) {
+        go [&, i]{
+            for (int r = 0; r < kRounds; ++r) {
+                co_blocking_region region;
+                if (region.IsHandedOff()) ++handedOff;
+
+                if (i % 2) {
+                    Processer::Suspend(std::chrono::milliseconds(1));
+                    co_yield;
+                } else {
+                    // 一半在channel上互相等待
+                    if (i % 4) ch << r;
+                    else ch >> nullptr;
+                }
+
+                // 挂起后区域已经结束, 可以再次进入
+                co_blocking_region inner;
+                if (inner.IsHandedOff()) ++reentered;
+            }
+            ++done;
+        };
+    }
+    WaitUntilNoTask();
+    EXPECT_EQ(done, kTasks);
+    EXPECT_GT(handedOff, 0);
+    EXPECT_GT(reentered, 0);
+}
+
+// 不主动让出的计算循环
+static void BusyLoop(std::chrono::milliseconds dur)
+{
+    auto deadline = std::chrono::steady_clock::now() + dur;
+    volatile uint64_t x = 0;
+    while (std::chrono::steady_clock::now() < deadline)
+        for (int i = 0; i < 100000; ++i)
+            x += i;
+}
+
+TEST(Scheduler, preempt)
+{
+#if defined(LIBGO_SYS_Linux)
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldSlice = opt.preempt_time_slice_us;
+    opt.preempt_time_slice_us = 5000;
+
+    std::atomic<uint64_t> hogYields{0};
+    std::atomic<uint64_t> guardedYields{99};
+    go [&]{
+        BusyLoop(std::chrono::milliseconds(300));
+        hogYields = co_sched.GetCurrentTaskYieldCount();
+    };
+    go [&]{
+        co_non_preemptible np;
+        uint64_t before = co_sched.GetCurrentTaskYieldCount();
+        BusyLoop(std::chrono::milliseconds(100));
+        guardedYields = co_sched.GetCurrentTaskYieldCount() - before;
+    };
+    WaitUntilNoTask();
+    opt.preempt_time_slice_us = oldSlice;
+
+    EXPECT_GT(hogYields, 0u);
+    EXPECT_EQ(guardedYields, 0u);
+#endif
+}
+
+TEST(Scheduler, preemptInChannel)
+{
+#if defined(LIBGO_SYS_Linux)
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldSlice = opt.preempt_time_slice_us;
+    opt.preempt_time_slice_us = 1000;
+
+    // 只有一个调度线程: 被抢占的协程还持有channel的锁时,
+    // 同一线程上的其他协程再加锁就会卡死整个调度线程
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 1); }).detach();
+
+    // 容量足够, 读写都不会挂起: 每个协程一直跑到被抢占为止, 抢占常常落在Push/Pop里
+    const int kTasks = 4;
+    co_chan<int> ch(kTasks);
+    std::atomic<int> done{0};
+    std::atomic<uint64_t> preempted{0};
+    for (int i = 0; i < kTasks; ++i) {
+        go co_scheduler(sched) [&]{
+            uint64_t before = sched->GetCurrentTaskYieldCount();
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+            while (std::chrono::steady_clock::now() < deadline) {
+                int v = 0;
+                ch << 1;
+                ch >> v;
+            }
+            preempted += sched->GetCurrentTaskYieldCount() - before;
+            ++done;
+        };
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (done < kTasks && std::chrono::steady_clock::now() < deadline)
+        usleep(1000);
+    opt.preempt_time_slice_us = oldSlice;
+
+    EXPECT_EQ(done, kTasks);
+    EXPECT_GT(preempted, 0u);
+#endif
+}
+
+TEST(Scheduler, preemptInBroadcast)
+{
+#if defined(LIBGO_SYS_Linux)
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldSlice = opt.preempt_time_slice_us;
+    opt.preempt_time_slice_us = 1000;
+
+    // 只有一个调度线程: 订阅者在读取中被抢占的话, 覆盖这个slot的发布者会一直等下去
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 1); }).detach();
+
+    co::BroadcastChannel<int> ch(2, lag_policy::drop_oldest);
+    auto sub = ch.Subscribe();
+    std::atomic<int> done{0};
+    std::atomic<int> reads{0};
+    go co_scheduler(sched) [&]{
+        // 读取时空转超过一个时间片(不调用库函数), 抢占会落在读取中
+        while (sub.Visit([&](int const&) {
+                    for (volatile int k = 0; k < 2000000; ++k) ;
+                }))
+            ++reads;
+        ++done;
+    };
+    go co_scheduler(sched) [&]{
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+        for (int i = 0; std::chrono::steady_clock::now() < deadline; ++i) {
+            ch.TryPublish(i);
+            co_yield;
+        }
+        ch.Close();
+        ++done;
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (done < 2 && std::chrono::steady_clock::now() < deadline)
+        usleep(1000);
+    opt.preempt_time_slice_us = oldSlice;
+
+    EXPECT_EQ(done, 2);
+    EXPECT_GT(reads, 0);
+#endif
+}
+
+TEST(Scheduler, maybeYield)
+{
+    // 不在协程中什么也不做
+    for (int i = 0; i < 10000; ++i)
+        co_maybe_yield();
+
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldSlice = opt.maybe_yield_slice_us;
+    opt.maybe_yield_slice_us = 2000;
+
+    // 长循环中每次迭代都调用, 只在时间片用完时才切出
+    std::atomic<uint64_t> yields{0};
+    std::atomic<uint64_t> calls{0};
+    go [&]{
+        uint64_t before = co_sched.GetCurrentTaskYieldCount();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (std::chrono::steady_clock::now() < deadline) {
+            co_maybe_yield();
+            ++calls;
+        }
+        yields = co_sched.GetCurrentTaskYieldCount() - before;
+    };
+    WaitUntilNoTask();
+    opt.maybe_yield_slice_us = oldSlice;
+
+    EXPECT_GT(yields, 0u);
+    EXPECT_LT(yields * 100, (uint64_t)calls);
+}
+
+// 每次执行约20微秒后让出, 直到deadline
+static void YieldingWork(std::chrono::steady_clock::time_point deadline)
+{
+    while (std::chrono::steady_clock::now() < deadline) {
+        auto sliceEnd = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+        volatile uint64_t x = 0;
+        while (std::chrono::steady_clock::now() < sliceEnd)
+            for (int i = 0; i < 100; ++i)
+                x += i;
+        co_yield;
+    }
+}
+
+TEST(Scheduler, taskGroup)
+{
+    // 单线程的调度器, 组之间只能靠调度顺序分享CPU
+    Scheduler & sched = *Scheduler::Create();
+    co_task_group* noisy = TaskGroup::Create("noisy");
+    co_task_group* quiet = TaskGroup::Create("quiet");
+    co_task_group* heavy = TaskGroup::Create("heavy", 3 * TaskGroup::kDefaultWeight);
+    co_task_group* light = TaskGroup::Create("light");
+
+    // 协程数量相差100倍, 权重相同
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    for (int i = 0; i < 200; ++i)
+        go co_scheduler(sched) co_group(noisy) [=]{ YieldingWork(deadline); };
+    go co_scheduler(sched) co_group(quiet) [=]{
+        // 子协程继承所在的组
+        go [=]{ YieldingWork(deadline); };
+        YieldingWork(deadline);
+    };
+
+    std::thread t([&]{ sched.Start(1, 1); });
+    t.detach();
+    WaitUntilNoTaskS(sched);
+
+    double noisyUs = noisy->CpuTime().count() / 1000.0;
+    double quietUs = quiet->CpuTime().count() / 1000.0;
+    EXPECT_GT(quietUs, 0.3 * (noisyUs + quietUs));
+    EXPECT_GT(noisyUs, 0.3 * (noisyUs + quietUs));
+
+    // 协程数量相同, 权重3:1
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    for (int i = 0; i < 10; ++i) {
+        go co_scheduler(sched) co_group(heavy) [=]{ YieldingWork(deadline); };
+        go co_scheduler(sched) co_group(light) [=]{ YieldingWork(deadline); };
+    }
+    WaitUntilNoTaskS(sched);
+
+    double heavyUs = heavy->CpuTime().count() / 1000.0;
+    double lightUs = light->CpuTime().count() / 1000.0;
+    EXPECT_GT(heavyUs, 0.6 * (heavyUs + lightUs));
+    EXPECT_LT(heavyUs, 0.9 * (heavyUs + lightUs));
+}
+
+TEST(Scheduler, runNext)
+{
+    // 只有一个调度线程, 唤醒者和等待者在同一个Processer上
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 1); }).detach();
+
+    std::vector<int> order;
+    Processer* waiterProc = nullptr;
+    Processer* wakerProc = nullptr;
+    Processer::SuspendEntry entry;
+
+    // 由一个协程统一创建, 保证三个协程按顺序进入runnable队列
+    go co_scheduler(sched) [&]{
+        go co_scheduler(sched) [&]{
+            entry = Processer::Suspend();
+            co_yield;
+            waiterProc = Processer::GetCurrentProcesser();
+            order.push_back(1);
+        };
+        go co_scheduler(sched) [&]{
+            wakerProc = Processer::GetCurrentProcesser();
+            Processer::Wakeup(entry);
+            co_yield;
+            order.push_back(3);
+        };
+        go co_scheduler(sched) [&]{
+            order.push_back(2);
+        };
+    };
+    WaitUntilNoTaskS(*sched);
+
+    // 被唤醒的协程排在队列中已有的协程之前, 紧跟唤醒者执行
+    ASSERT_EQ(order.size(), 3u);
+    EXPECT_EQ(order[0], 1);
+    EXPECT_TRUE(waiterProc == wakerProc);
+}
+
+TEST(Scheduler, cpuTopology)
+{
+    CpuTopology & topo = CpuTopology::getInstance();
+    EXPECT_EQ(topo.GetDistance(-1, 0), CpuTopology::remote);
+#if defined(LIBGO_SYS_Linux)
+    int cpu = CpuTopology::CurrentCpu();
+    EXPECT_GE(cpu, 0);
+    EXPECT_TRUE(topo.IsKnown());
+    EXPECT_EQ(topo.GetDistance(cpu, cpu), CpuTopology::same_core);
+#endif
+
+    // 负载均衡之后协程都能执行完
+    std::atomic<int> n{0};
+    for (int i = 0; i < 1000; ++i)
+        go [&]{
+            co_yield;
+            ++n;
+        };
+    WaitUntilNoTask();
+    EXPECT_EQ(n, 1000);
+}
+
+TEST(Scheduler, idleShrink)
+{
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldIdle = opt.idle_thread_exit_us;
+    opt.idle_thread_exit_us = 100 * 1000;
+
+    // 1个活跃线程 + 1个备用线程, 最多4个
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 4); }).detach();
+    while (sched->ThreadCount() < 2) usleep(1000);
+
+    // 挂起的协程分散在各个调度线程上, 它们所在的线程退出后仍然能被唤醒
+    co_chan<int> ch;
+    std::atomic<int> received{0};
+    std::atomic<int> regions{0};
+    auto blockingRound = [&]{
+        for (int i = 0; i < 3; ++i)
+            go co_scheduler(sched) [&]{
+                go co_scheduler(sched) [&]{
+                    int v;
+                    ch >> v;
+                    ++received;
+                };
+                co_blocking_region region;
+                BlockingSleep(200);
+                ++regions;
+            };
+    };
+
+    // 阻塞时扩展调度线程
+    blockingRound();
+    uint32_t peak = 0;
+    for (int i = 0; i < 3000 && regions < 3; ++i) {
+        peak = (std::max)(peak, sched->ThreadCount());
+        usleep(1000);
+    }
+    peak = (std::max)(peak, sched->ThreadCount());
+    EXPECT_GT(peak, 2u);
+    EXPECT_LE(peak, 4u);
+
+    // 空闲后收缩回1个活跃线程 + 1个备用线程
+    for (int i = 0; i < 3000 && sched->ThreadCount() > 2; ++i)
+        usleep(1000);
+    EXPECT_EQ(sched->ThreadCount(), 2u);
+
+    for (int i = 0; i < 3; ++i)
+        ch << i;
+    while (received < 3 && sched->TaskCount() > 0) usleep(1000);
+    EXPECT_EQ(received, 3);
+
+    // 再次扩展时复用退出的Processer
+    blockingRound();
+    for (int i = 0; i < 3; ++i)
+        ch << i;
+    WaitUntilNoTaskS(*sched);
+    EXPECT_EQ(received, 6);
+    EXPECT_LE(sched->ThreadCount(), 4u);
+    opt.idle_thread_exit_us = oldIdle;
+}
+
+TEST(Scheduler, processerArray)
+{
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldIdle = opt.idle_thread_exit_us;
+    opt.idle_thread_exit_us = 20 * 1000;
+
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(1, 6); }).detach();
+    while (sched->ThreadCount() < 2) usleep(1000);
+
+    // 调度线程反复扩展、收缩的同时, 原生线程不断放入新协程
+    const int kThreads = 4, kTasks = 2000;
+    std::atomic<int> done{0};
+    std::atomic<bool> stop{false};
+    std::thread grower([&]{
+        while (!stop) {
+            for (int i = 0; i < 3; ++i)
+                go co_scheduler(sched) []{
+                    co_blocking_region region;
+                    BlockingSleep(5);
+                };
+            usleep(40 * 1000);
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < kThreads; ++t)
+        producers.emplace_back([&]{
+            for (int i = 0; i < kTasks; ++i) {
+                go co_scheduler(sched) [&]{ ++done; };
+                if (i % 100 == 0) usleep(1000);
+            }
+        });
+    for (auto & t : producers)
+        t.join();
+    stop = true;
+    grower.join();
+
+    WaitUntilNoTaskS(*sched);
+    EXPECT_EQ(done, kThreads * kTasks);
+    EXPECT_GE(sched->ThreadCount(), 2u);
+    EXPECT_LE(sched->ThreadCount(), 6u);
+    opt.idle_thread_exit_us = oldIdle;
+}
+
+TEST(Scheduler, taskPlacement)
+{
+    // 推迟调度线程的第一次负载均衡, 只看放置的结果
+    auto & opt = CoroutineOptions::getInstance();
+    uint32_t oldCycle = opt.dispatcher_thread_cycle_us;
+    eTaskPlacement oldPlacement = opt.task_placement;
+    opt.dispatcher_thread_cycle_us = 1000 * 1000;
+
+    static Scheduler *sched = Scheduler::Create();
+    std::thread([]{ sched->Start(4, 4); }).detach();
+    while (sched->ThreadCount() < 4) usleep(1000);
+
+    // 一个不让出的协程连续创建协程, 返回执行过这些协程的调度线程数
+    auto fanOut = [&](eTaskPlacement placement) {
+        opt.task_placement = placement;
+        std::mutex mtx;
+        std::set<Processer*> procs;
+        go co_scheduler(sched) [&]{
+            for (int i = 0; i < 64; ++i)
+                go co_scheduler(sched) [&]{
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        procs.insert(Processer::GetCurrentProcesser());
+                    }
+                    BusyLoop(std::chrono::milliseconds(1));
+                };
+        };
+        WaitUntilNoTaskS(*sched);
+        return procs.size();
+    };
+
+    EXPECT_EQ(fanOut(eTaskPlacement::local_first), 1u);
+    EXPECT_GE(fanOut(eTaskPlacement::power_of_two), 3u);
+
+    // 原生线程中创建的协程轮流放到各个调度线程上
+    opt.task_placement = eTaskPlacement::round_robin;
+    std::mutex mtx;
+    std::set<Processer*> procs;
+    for (int i = 0; i < 8; ++i)
+        go co_scheduler(sched) [&]{
+            std::unique_lock<std::mutex> lock(mtx);
+            procs.insert(Processer::GetCurrentProcesser());
+        };
+    WaitUntilNoTaskS(*sched);
+    EXPECT_EQ(procs.size(), 4u);
+
+    opt.task_placement = oldPlacement;
+    opt.dispatcher_thread_cycle_us = oldCycle;
+}
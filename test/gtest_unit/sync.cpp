@@ -0,0 +1,146 @@
+#include <iostream>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "coroutine.h"
+#include <boost/thread.hpp>
+#include "gtest_exit.h"
+using namespace std;
+using namespace co;
+
+TEST(Sync, wait_group)
+{
+    // 协程中等待
+    for (int round = 0; round < 10; ++round) {
+        co_wait_group wg;
+        std::atomic<int> sum{0};
+        std::atomic<bool> waited{false};
+        go [&]{
+            for (int i = 0; i < 100; ++i) {
+                wg.Add();
+                go [&, i]{
+                    if (i % 3 == 0) co_yield;
+                    sum += i;
+                    wg.Done();
+                };
+            }
+            wg.Wait();
+            EXPECT_EQ(sum, 4950);
+            waited = true;
+        };
+        WaitUntilNoTask();
+        EXPECT_TRUE(waited);
+        EXPECT_EQ(wg.Count(), 0);
+    }
+
+    // 原生线程中等待, 多个等待者一次唤醒
+    {
+        co_wait_group wg(16);
+        std::atomic<int> woken{0};
+        std::vector<std::thread> waiters;
+        for (int i = 0; i < 4; ++i)
+            waiters.emplace_back([&]{ wg.Wait(); ++woken; });
+        for (int i = 0; i < 4; ++i)
+            go [&]{ wg.Wait(); ++woken; };
+        for (int i = 0; i < 16; ++i)
+            go [&]{ co_sleep(10); wg.Done(); };
+        for (auto & t : waiters) t.join();
+        WaitUntilNoTask();
+        EXPECT_EQ(woken, 8);
+    }
+
+    // 超时
+    {
+        co_wait_group wg(1);
+        EXPECT_FALSE(wg.WaitFor(std::chrono::milliseconds(20)));
+        wg.Done();
+        EXPECT_TRUE(wg.WaitFor(std::chrono::milliseconds(20)));
+    }
+}
+
+TEST(Sync, latch)
+{
+    co_latch latch(8);
+    std::atomic<int> passed{0};
+    for (int i = 0; i < 8; ++i)
+        go [&]{
+            latch.arrive_and_wait();
+            ++passed;
+        };
+    WaitUntilNoTask();
+    EXPECT_TRUE(latch.try_wait());
+    EXPECT_EQ(passed, 8);
+}
+
+TEST(Sync, barrier)
+{
+    const int kParties = 8, kPhases = 50;
+    std::atomic<int> completions{0};
+    std::atomic<int> errors{0};
+    std::vector<std::atomic<int>> arrived(kPhases);
+    co_barrier barrier(kParties, [&]{ ++completions; });
+    for (int i = 0; i < kParties; ++i)
+        go [&]{
+            for (int phase = 0; phase < kPhases; ++phase) {
+                ++arrived[phase];
+                barrier.arrive_and_wait();
+                // 越过屏障时本阶段所有参与者都已到达
+                if (arrived[phase] != kParties) ++errors;
+            }
+        };
+    WaitUntilNoTask();
+    EXPECT_EQ(errors, 0);
+    EXPECT_EQ(completions, kPhases);
+
+    // 退出的参与者不再计入之后的阶段
+    co_barrier barrier2(2);
+    std::atomic<int> passed{0};
+    go [&]{ barrier2.arrive_and_drop(); };
+    go [&]{
+        barrier2.arrive_and_wait();
+        barrier2.arrive_and_wait();
+        ++passed;
+    };
+    WaitUntilNoTask();
+    EXPECT_EQ(passed, 1);
+}
+
+TEST(Sync, semaphore)
+{
+    // 最多4个并发
+    co_semaphore sem(4);
+    std::atomic<int> running{0}, maxRunning{0};
+    for (int i = 0; i < 64; ++i)
+        go [&]{
+            sem.acquire();
+            int n = ++running;
+            int m = maxRunning;
+            while (n > m && !maxRunning.compare_exchange_weak(m, n)) ;
+            co_sleep(1);
+            --running;
+            sem.release();
+        };
+    WaitUntilNoTask();
+    EXPECT_LE(maxRunning, 4);
+    EXPECT_EQ(sem.available(), 4u);
+
+    // acquire(n)/release(n), 协程和原生线程混合
+    co_semaphore tokens(0);
+    std::atomic<int> got{0};
+    std::thread native([&]{ tokens.acquire(3); got += 3; });
+    go [&]{ tokens.acquire(2); got += 2; };
+    go [&]{
+        for (int i = 0; i < 5; ++i) {
+            co_sleep(2);
+            tokens.release(1);
+        }
+    };
+    native.join();
+    WaitUntilNoTask();
+    EXPECT_EQ(got, 5);
+    EXPECT_EQ(tokens.available(), 0u);
+
+    EXPECT_FALSE(tokens.try_acquire());
+    EXPECT_FALSE(tokens.try_acquire_for(std::chrono::milliseconds(10)));
+    tokens.release(2);
+    EXPECT_TRUE(tokens.try_acquire(2));
+}
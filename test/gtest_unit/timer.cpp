@@ -70,3 +70,28 @@ TEST(Timer, OnTime3)
         q >> nullptr;
 }
 
+
+TEST(Timer, PreemptOffDepth)
+{
+    // 定时器协程等待触发时会切换协程, 不能让挂起或恢复它的线程计入禁止抢占
+    int c = 10;
+    co_chan<void> q(c);
+    for (int i = 0; i < c; i++)
+        timer.ExpireAt(std::chrono::milliseconds(i), [&]{ q << nullptr; });
+    for (int i = 0; i < c; i++)
+        q >> nullptr;
+
+    const int kRounds = 10, kTasks = 100;
+    std::atomic<int> done{0};
+    std::atomic<int> nonZero{0};
+    for (int r = 0; r < kRounds; r++) {
+        for (int i = 0; i < kTasks; i++)
+            go [&]{
+                if (PreemptOffDepth() != 0) ++nonZero;
+                ++done;
+            };
+        usleep(2000);
+    }
+    while (done < kRounds * kTasks) usleep(1000);
+    EXPECT_EQ(nonZero, 0);
+}